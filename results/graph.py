@@ -1,3 +1,5 @@
+import os
+
 import pandas as pd
 import matplotlib.pyplot as plt
 
@@ -45,3 +47,54 @@ plt.legend()
 plt.tight_layout()
 plt.savefig("plot.png", dpi=300, bbox_inches="tight")
 plt.close()
+
+# Latency CDFs from `profile latency`, one panel per data size with a line per tree.
+if os.path.exists("latency.csv"):
+    latency = pd.read_csv("latency.csv")
+    sizes = sorted(latency["size"].unique())
+
+    fig, axes = plt.subplots(
+        1, len(sizes), figsize=(4 * len(sizes), 4), dpi=300, sharey=True, squeeze=False
+    )
+    for ax, size in zip(axes[0], sizes):
+        for algo, data in latency[latency["size"] == size].groupby("name", sort=False):
+            ax.plot(data["latency_ns"], data["percentile"], label=algo)
+
+        ax.set_xscale("log")
+        ax.set_title(f"2^{size} bytes")
+        ax.set_xlabel("Latency (ns)")
+        ax.grid(True, which="both", alpha=0.3)
+
+    axes[0][0].set_ylabel("Fraction of queries")
+    axes[0][0].legend()
+
+    plt.tight_layout()
+    plt.savefig("latency.png", dpi=300, bbox_inches="tight")
+    plt.close()
+
+# Node layouts from `profile tune`: time per query against node width at each size, with the
+# fastest batch size for batching_bplus.
+if os.path.exists("layout.csv"):
+    layout = pd.read_csv("layout.csv")
+    layout = layout.loc[layout.groupby(["name", "size", "width"])["ns_per_query"].idxmin()]
+    names = list(layout["name"].unique())
+
+    fig, axes = plt.subplots(
+        1, len(names), figsize=(5 * len(names), 4), dpi=300, sharey=True, squeeze=False
+    )
+    for ax, name in zip(axes[0], names):
+        for size, data in layout[layout["name"] == name].groupby("size"):
+            ax.plot(data["width"], data["ns_per_query"], marker="o", label=f"2^{size} bytes")
+
+        ax.set_xscale("log", base=2)
+        ax.set_yscale("log")
+        ax.set_title(name)
+        ax.set_xlabel("Keys per node")
+        ax.grid(True, which="both", alpha=0.3)
+
+    axes[0][0].set_ylabel("Reciprocal Throughput (ns)")
+    axes[0][0].legend()
+
+    plt.tight_layout()
+    plt.savefig("layout.png", dpi=300, bbox_inches="tight")
+    plt.close()
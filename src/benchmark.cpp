@@ -1,14 +1,54 @@
 #include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <x86intrin.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
 #include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "common.hpp"
+#include "latency_histogram.hpp"
+#include "layout.hpp"
+#include "parallel_lookup.hpp"
+#include "perf_counters.hpp"
+#include "published.hpp"
+#include "tree_arena.hpp"
+#include "trees/isa.hpp"
 #include "trees/batching_bplus.hpp"
 #include "trees/bplus.hpp"
 #include "trees/btree.hpp"
+#include "trees/compressed_bplus.hpp"
+#include "trees/delta_bplus.hpp"
+#include "trees/numa_bplus.hpp"
+#include "trees/prefix_bplus.hpp"
+#include "trees/runtime_bplus.hpp"
+#include "workload.hpp"
+
+// Adds the per query hardware counts of the loop bracketed by counters, where available.
+static void report_perf_counters(benchmark::State& state, const perf_counters& counters,
+                                 size_t queries) {
+    for (int e = 0; e < perf_counters::count; e++) {
+        if (auto value = counters[static_cast<perf_counters::event>(e)]) {
+            state.counters[perf_counters::names[e]] = *value / queries;
+        }
+    }
+}
 
 static void BM_lower_bound(benchmark::State& state) {
     const size_t power = state.range(0);
@@ -22,12 +62,18 @@ static void BM_lower_bound(benchmark::State& state) {
     int max_val = data.empty() ? 100 : data.back();
     std::uniform_int_distribution<int> dist(min_val, max_val);
 
+    perf_counters counters;
+    counters.start();
+
     for (auto _ : state) {
         int query = dist(rng);
         benchmark::DoNotOptimize(std::lower_bound(data.begin(), data.end(), query));
         benchmark::ClobberMemory();
     }
 
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations());
     state.counters["time_per_query"] = benchmark::Counter(
         state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
 }
@@ -46,16 +92,64 @@ static void BM_btree(benchmark::State& state) {
     int max_val = data.empty() ? 100 : data.back();
     std::uniform_int_distribution<int> dist(min_val, max_val);
 
+    perf_counters counters;
+    counters.start();
+
     for (auto _ : state) {
         int query = dist(rng);
         benchmark::DoNotOptimize(tree.lower_bound(query));
         benchmark::ClobberMemory();
     }
 
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations());
     state.counters["time_per_query"] = benchmark::Counter(
         state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
 }
 
+// BM_btree for B queries at a time, prefetching each query's next block or, with Speculate, that
+// block's children too.
+template <size_t B, bool Speculate>
+static void BM_batching_btree(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    btree tree(data);
+
+    std::mt19937 rng(12345);
+    int min_val = data.empty() ? 0 : data.front();
+    int max_val = data.empty() ? 100 : data.back();
+    std::uniform_int_distribution<int> dist(min_val, max_val);
+
+    int batch_queries[B];
+    int batch_results[B];
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        tree.lower_bound_batch<B, Speculate>(batch_queries, batch_results);
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * B);
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
 template <size_t power>
 static void BM_bplus_helper(benchmark::State& state) {
     constexpr size_t elements = (1ULL << power) / sizeof(int);
@@ -70,12 +164,18 @@ static void BM_bplus_helper(benchmark::State& state) {
     int max_val = data.empty() ? 100 : data.back();
     std::uniform_int_distribution<int> dist(min_val, max_val);
 
+    perf_counters counters;
+    counters.start();
+
     for (auto _ : state) {
         int query = dist(rng);
         benchmark::DoNotOptimize(tree.lower_bound(query));
         benchmark::ClobberMemory();
     }
 
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations());
     state.counters["time_per_query"] = benchmark::Counter(
         state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
 }
@@ -105,6 +205,9 @@ static void BM_batching_bplus_helper(benchmark::State& state) {
     int batch_queries[B];
     int batch_results[B];
 
+    perf_counters counters;
+    counters.start();
+
     for (auto _ : state) {
         for (size_t i = 0; i < B; i++) {
             batch_queries[i] = dist(rng);
@@ -116,6 +219,9 @@ static void BM_batching_bplus_helper(benchmark::State& state) {
         benchmark::ClobberMemory();
     }
 
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * B);
     state.SetItemsProcessed(state.iterations() * B);
     state.counters["time_per_query"] = benchmark::Counter(
         state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
@@ -166,13 +272,1620 @@ static void BM_batching_bplus_64(benchmark::State& state) {
     }
 }
 
-BENCHMARK(BM_lower_bound)->DenseRange(1, 30);
-BENCHMARK(BM_btree)->DenseRange(1, 30);
-BENCHMARK(BM_bplus)->DenseRange(1, 30);
-BENCHMARK(BM_batching_bplus_4)->DenseRange(1, 30);
-BENCHMARK(BM_batching_bplus_8)->DenseRange(1, 30);
-BENCHMARK(BM_batching_bplus_16)->DenseRange(1, 30);
-BENCHMARK(BM_batching_bplus_32)->DenseRange(1, 30);
-BENCHMARK(BM_batching_bplus_64)->DenseRange(1, 30);
+template <typename T>
+static void BM_runtime_bplus(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(T);
+
+    auto data = generate_random_data<T>(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<T> tree(data);
+
+    std::mt19937 rng(12345);
+    T min_val = data.empty() ? 0 : data.front();
+    T max_val = data.empty() ? 100 : data.back();
+    uniform_distribution<T> dist(min_val, max_val);
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        T query = dist(rng);
+        benchmark::DoNotOptimize(tree.lower_bound(query));
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations());
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+template <size_t B, typename T = int>
+static void BM_batching_runtime_bplus(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(T);
+
+    auto data = generate_random_data<T>(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<T> tree(data);
+
+    std::mt19937 rng(12345);
+    T min_val = data.empty() ? 0 : data.front();
+    T max_val = data.empty() ? 100 : data.back();
+    uniform_distribution<T> dist(min_val, max_val);
+
+    T batch_queries[B];
+    T batch_results[B];
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        tree.template lower_bound_batch<B>(batch_queries, batch_results);
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * B);
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// BM_batching_runtime_bplus with the vertical (Hybrid = false) or hybrid traversal.
+template <size_t B, bool Hybrid>
+static void BM_vertical_runtime_bplus(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<> tree(data);
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+
+    int batch_queries[B];
+    int batch_results[B];
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        if constexpr (Hybrid) {
+            tree.lower_bound_batch_hybrid<B>(batch_queries, batch_results);
+        } else {
+            tree.lower_bound_batch_vertical<B>(batch_queries, batch_results);
+        }
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * B);
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// Same as BM_batching_runtime_bplus, but returning the rank of the lower bound rather than the key.
+template <size_t B>
+static void BM_batching_runtime_bplus_rank(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<> tree(data);
+
+    std::mt19937 rng(12345);
+    int min_val = data.empty() ? 0 : data.front();
+    int max_val = data.empty() ? 100 : data.back();
+    std::uniform_int_distribution<int> dist(min_val, max_val);
+
+    int batch_queries[B];
+    size_t batch_results[B];
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        tree.lower_bound_rank_batch<B>(batch_queries, batch_results);
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// Returns a 64-bit payload per query, which costs an extra two cache lines per leaf block.
+template <size_t B>
+static void BM_batching_runtime_bplus_value(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    std::vector<uint64_t> row_ids(elements);
+    for (size_t i = 0; i < elements; i++) {
+        row_ids[i] = i;
+    }
+
+    runtime_bplus<int, uint64_t> tree(data, row_ids);
+
+    std::mt19937 rng(12345);
+    int min_val = data.empty() ? 0 : data.front();
+    int max_val = data.empty() ? 100 : data.back();
+    std::uniform_int_distribution<int> dist(min_val, max_val);
+
+    int batch_queries[B];
+    uint64_t batch_results[B];
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        tree.lower_bound_value_batch<B>(batch_queries, batch_results);
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// Throughput of lower_bound_parallel() over a large query array, with range(1) pinned threads. At
+// large sizes this shows where adding cores stops helping because memory bandwidth is saturated.
+template <size_t B>
+static void BM_parallel_runtime_bplus(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t threads = state.range(1);
+    const size_t elements = (1ULL << power) / sizeof(int);
+    constexpr size_t num_queries = 1 << 22;
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<> tree(data);
+    thread_pool pool(threads, true);
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+
+    std::vector<int> queries(num_queries);
+    for (int& query : queries) {
+        query = dist(rng);
+    }
+    std::vector<int> results(num_queries);
+
+    for (auto _ : state) {
+        lower_bound_parallel<B>(pool, tree, queries, results);
+
+        benchmark::DoNotOptimize(results.data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * num_queries);
+    state.counters["time_per_query"] = benchmark::Counter(state.iterations() * num_queries,
+                                                          benchmark::Counter::kIsRate |
+                                                              benchmark::Counter::kInvert);
+}
+
+static void parallel_sweep(benchmark::internal::Benchmark* b) {
+    int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    for (int power : {26, 30}) {
+        for (int threads = 1; threads <= cores; threads++) {
+            b->Args({power, threads});
+        }
+    }
+}
+
+// Counting the keys in a random range, the way callers did before count(): two binary searches.
+static void BM_count_lower_bound(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    std::mt19937 rng(12345);
+    int min_val = data.empty() ? 0 : data.front();
+    int max_val = data.empty() ? 100 : data.back();
+    std::uniform_int_distribution<int> dist(min_val, max_val);
+
+    for (auto _ : state) {
+        auto [lo, hi] = std::minmax(dist(rng), dist(rng));
+        auto first = std::lower_bound(data.begin(), data.end(), lo);
+        benchmark::DoNotOptimize(std::lower_bound(first, data.end(), hi) - first);
+        benchmark::ClobberMemory();
+    }
+
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+static void BM_runtime_bplus_count(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<> tree(data);
+
+    std::mt19937 rng(12345);
+    int min_val = data.empty() ? 0 : data.front();
+    int max_val = data.empty() ? 100 : data.back();
+    std::uniform_int_distribution<int> dist(min_val, max_val);
+
+    for (auto _ : state) {
+        auto [lo, hi] = std::minmax(dist(rng), dist(rng));
+        benchmark::DoNotOptimize(tree.count(lo, hi));
+        benchmark::ClobberMemory();
+    }
+
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+template <size_t B>
+static void BM_batching_runtime_bplus_count(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<> tree(data);
+
+    std::mt19937 rng(12345);
+    int min_val = data.empty() ? 0 : data.front();
+    int max_val = data.empty() ? 100 : data.back();
+    std::uniform_int_distribution<int> dist(min_val, max_val);
+
+    int los[B];
+    int his[B];
+    size_t counts[B];
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            std::tie(los[i], his[i]) = std::minmax(dist(rng), dist(rng));
+        }
+
+        tree.count_batch<B>(los, his, counts);
+
+        benchmark::DoNotOptimize(counts);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// Build time from sorted keys in memory, serially or with range(1) threads.
+static void BM_runtime_bplus_build(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t threads = state.range(1);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    thread_pool pool(threads, true);
+
+    for (auto _ : state) {
+        if (threads == 1) {
+            runtime_bplus<> tree(data);
+            benchmark::DoNotOptimize(tree.lower_bound(data.front()));
+        } else {
+            runtime_bplus<> tree(data, pool);
+            benchmark::DoNotOptimize(tree.lower_bound(data.front()));
+        }
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * elements * sizeof(int));
+}
+
+// Build time streaming the keys in from a file in the page cache, without an input vector.
+static void BM_runtime_bplus_build_streaming(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    std::string path = (std::filesystem::temp_directory_path() / "bench_keys.bin").string();
+    {
+        auto data = generate_random_data(elements);
+        std::sort(data.begin(), data.end());
+        std::ofstream(path, std::ios::binary)
+            .write(reinterpret_cast<const char*>(data.data()), elements * sizeof(int));
+    }
+
+    for (auto _ : state) {
+        auto tree = runtime_bplus<>::from_file(path.c_str());
+        benchmark::DoNotOptimize(tree.lower_bound(0));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * elements * sizeof(int));
+    std::filesystem::remove(path);
+}
+
+static void build_sweep(benchmark::internal::Benchmark* b) {
+    int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    for (int power = 10; power <= 30; power += 2) {
+        b->Args({power, 1});
+        if (cores > 1) {
+            b->Args({power, cores});
+        }
+    }
+}
+
+// Evicts a file from the page cache, so that the next read of it goes to disk.
+static void drop_page_cache(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Starting from cold files: the sorted keys for building, and a saved tree for opening.
+static std::pair<std::string, std::string> cold_start_files(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    auto dir = std::filesystem::temp_directory_path();
+    std::string keys_path = (dir / "bench_keys.bin").string();
+    std::string tree_path = (dir / "bench_tree.bin").string();
+
+    std::ofstream(keys_path, std::ios::binary)
+        .write(reinterpret_cast<const char*>(data.data()), elements * sizeof(int));
+    runtime_bplus<>(data).save(tree_path.c_str());
+
+    return {keys_path, tree_path};
+}
+
+// Time to a first answer when starting by reading the sorted keys and building the tree.
+static void BM_runtime_bplus_build_cold(benchmark::State& state) {
+    const size_t elements = (1ULL << state.range(0)) / sizeof(int);
+    auto [keys_path, tree_path] = cold_start_files(state);
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist;
+    double first_query_ns = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        drop_page_cache(keys_path);
+        state.ResumeTiming();
+
+        std::vector<int> data(elements);
+        std::ifstream(keys_path, std::ios::binary)
+            .read(reinterpret_cast<char*>(data.data()), elements * sizeof(int));
+        runtime_bplus<> tree(data);
+
+        auto start = std::chrono::steady_clock::now();
+        benchmark::DoNotOptimize(tree.lower_bound(dist(rng)));
+        first_query_ns += std::chrono::duration<double, std::nano>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    }
+
+    state.counters["first_query_ns"] =
+        benchmark::Counter(first_query_ns, benchmark::Counter::kAvgIterations);
+    std::filesystem::remove(keys_path);
+    std::filesystem::remove(tree_path);
+}
+
+// Time to a first answer when mapping a saved tree. With Populate, open() reads the whole file.
+template <bool Populate>
+static void BM_runtime_bplus_open_cold(benchmark::State& state) {
+    auto [keys_path, tree_path] = cold_start_files(state);
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist;
+    double first_query_ns = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        drop_page_cache(tree_path);
+        state.ResumeTiming();
+
+        auto tree = runtime_bplus<>::open(tree_path.c_str(), {.populate = Populate});
+
+        auto start = std::chrono::steady_clock::now();
+        benchmark::DoNotOptimize(tree.lower_bound(dist(rng)));
+        first_query_ns += std::chrono::duration<double, std::nano>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    }
+
+    state.counters["first_query_ns"] =
+        benchmark::Counter(first_query_ns, benchmark::Counter::kAvgIterations);
+    std::filesystem::remove(keys_path);
+    std::filesystem::remove(tree_path);
+}
+
+// The workload benchmarks run each tree over precomputed query streams (see workload.hpp). Replay
+// reads the file named by $BTREE_REPLAY_QUERIES, recorded as raw ints, and is skipped without it.
+static constexpr size_t workload_queries = 1 << 20;
+
+// The sorted keys and query stream for a workload benchmark, or nothing if it had to be skipped.
+static std::optional<std::pair<std::vector<int>, std::vector<int>>> workload_setup(
+    benchmark::State& state, workload w) {
+    const size_t elements = (1ULL << state.range(0)) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    workload_options options;
+    if (const char* path = std::getenv("BTREE_REPLAY_QUERIES")) {
+        options.replay_path = path;
+    } else if (w == workload::replay) {
+        state.SkipWithError("set BTREE_REPLAY_QUERIES to a file of recorded queries");
+        return std::nullopt;
+    }
+
+    auto queries = generate_queries<int>(w, data, workload_queries, options);
+    return std::pair{std::move(data), std::move(queries)};
+}
+
+// Feeds the query stream to lookup() B queries at a time, wrapping around at the end.
+template <size_t B, typename F>
+static void run_workload(benchmark::State& state, const std::vector<int>& queries, F&& lookup) {
+    static_assert(workload_queries % B == 0);
+    size_t next = 0;
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        lookup(&queries[next]);
+        next = (next + B) % workload_queries;
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * B);
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// Runs f.operator()<power>() for the compile time trees, instantiating only the listed sizes.
+template <size_t... Powers, typename F>
+static void with_power(size_t power, F&& f) {
+    ((power == Powers && (f.template operator()<Powers>(), true)) || ...);
+}
+
+// The same for any listed values, such as node widths and batch sizes.
+template <auto... Choices, typename F>
+static void with_choice(auto value, F&& f) {
+    ((value == Choices && (f.template operator()<Choices>(), true)) || ...);
+}
+
+#define WORKLOAD_POWERS 12, 16, 20, 24, 28
+#define TUNED_WIDTHS 8, 16, 32, 64
+#define TUNED_BATCHES 8, 16, 32, 64
+
+// The layout ./profile tune chose for tree at this size, read from results/layout.csv or the file
+// named by BTREE_LAYOUT, and reported alongside the results.
+static std::optional<tuned_layout> tuned_layout_for(benchmark::State& state, const char* tree) {
+    const char* path = std::getenv("BTREE_LAYOUT");
+    auto layout = read_tuned_layout(path ? path : "results/layout.csv", tree, state.range(0));
+    if (!layout) {
+        state.SkipWithError("no layout tuned for this size; run ./profile tune first");
+        return std::nullopt;
+    }
+
+    state.counters["width"] = layout->width;
+    state.counters["batch"] = layout->batch;
+    return layout;
+}
+
+static void BM_workload_lower_bound(benchmark::State& state, workload w) {
+    auto setup = workload_setup(state, w);
+    if (!setup) {
+        return;
+    }
+    auto& [data, queries] = *setup;
+
+    run_workload<1>(state, queries, [&](const int* query) {
+        benchmark::DoNotOptimize(std::lower_bound(data.begin(), data.end(), *query));
+    });
+}
+
+static void BM_workload_btree(benchmark::State& state, workload w) {
+    auto setup = workload_setup(state, w);
+    if (!setup) {
+        return;
+    }
+    auto& [data, queries] = *setup;
+
+    btree tree(data);
+    run_workload<1>(state, queries, [&](const int* query) {
+        benchmark::DoNotOptimize(tree.lower_bound(*query));
+    });
+}
+
+static void BM_workload_bplus(benchmark::State& state, workload w) {
+    auto setup = workload_setup(state, w);
+    if (!setup) {
+        return;
+    }
+    auto& [data, queries] = *setup;
+
+    with_power<WORKLOAD_POWERS>(state.range(0), [&]<size_t power>() {
+        bplus<(1ULL << power) / sizeof(int)> tree(data);
+        run_workload<1>(state, queries, [&](const int* query) {
+            benchmark::DoNotOptimize(tree.lower_bound(*query));
+        });
+    });
+}
+
+template <size_t B>
+static void BM_workload_batching_bplus(benchmark::State& state, workload w) {
+    auto setup = workload_setup(state, w);
+    if (!setup) {
+        return;
+    }
+    auto& [data, queries] = *setup;
+
+    with_power<WORKLOAD_POWERS>(state.range(0), [&]<size_t power>() {
+        batching_bplus<(1ULL << power) / sizeof(int), B> tree(data);
+        run_workload<B>(state, queries, [&](const int* batch_queries) {
+            int batch_results[B];
+            tree.lower_bound_batch(batch_queries, batch_results);
+            benchmark::DoNotOptimize(batch_results);
+        });
+    });
+}
+
+static void BM_workload_tuned_bplus(benchmark::State& state, workload w) {
+    auto layout = tuned_layout_for(state, "bplus");
+    if (!layout) {
+        return;
+    }
+    auto setup = workload_setup(state, w);
+    if (!setup) {
+        return;
+    }
+    auto& [data, queries] = *setup;
+
+    with_power<WORKLOAD_POWERS>(state.range(0), [&]<size_t power>() {
+        with_choice<TUNED_WIDTHS>(layout->width, [&]<int Width>() {
+            bplus<(1ULL << power) / sizeof(int), int, Width> tree(data);
+            run_workload<1>(state, queries, [&](const int* query) {
+                benchmark::DoNotOptimize(tree.lower_bound(*query));
+            });
+        });
+    });
+}
+
+static void BM_workload_tuned_batching_bplus(benchmark::State& state, workload w) {
+    auto layout = tuned_layout_for(state, "batching_bplus");
+    if (!layout) {
+        return;
+    }
+    auto setup = workload_setup(state, w);
+    if (!setup) {
+        return;
+    }
+    auto& [data, queries] = *setup;
+
+    with_power<WORKLOAD_POWERS>(state.range(0), [&]<size_t power>() {
+        with_choice<TUNED_WIDTHS>(layout->width, [&]<int Width>() {
+            with_choice<TUNED_BATCHES>(layout->batch, [&]<int B>() {
+                batching_bplus<(1ULL << power) / sizeof(int), B, int, Width> tree(data);
+                run_workload<B>(state, queries, [&](const int* batch_queries) {
+                    int batch_results[B];
+                    tree.lower_bound_batch(batch_queries, batch_results);
+                    benchmark::DoNotOptimize(batch_results);
+                });
+            });
+        });
+    });
+}
+
+template <size_t B>
+static void BM_workload_runtime_bplus(benchmark::State& state, workload w) {
+    auto setup = workload_setup(state, w);
+    if (!setup) {
+        return;
+    }
+    auto& [data, queries] = *setup;
+
+    runtime_bplus<> tree(data);
+    run_workload<B>(state, queries, [&](const int* batch_queries) {
+        if constexpr (B == 1) {
+            benchmark::DoNotOptimize(tree.lower_bound(*batch_queries));
+        } else {
+            int batch_results[B];
+            tree.lower_bound_batch<B>(batch_queries, batch_results);
+            benchmark::DoNotOptimize(batch_results);
+        }
+    });
+}
+
+// Registered at startup as BM_workload_<tree>/<workload>/<power>.
+static const bool workloads_registered = [] {
+    const std::pair<const char*, void (*)(benchmark::State&, workload)> trees[] = {
+        {"lower_bound", BM_workload_lower_bound},
+        {"btree", BM_workload_btree},
+        {"bplus", BM_workload_bplus},
+        {"batching_bplus_4", BM_workload_batching_bplus<4>},
+        {"batching_bplus_8", BM_workload_batching_bplus<8>},
+        {"batching_bplus_16", BM_workload_batching_bplus<16>},
+        {"batching_bplus_32", BM_workload_batching_bplus<32>},
+        {"batching_bplus_64", BM_workload_batching_bplus<64>},
+        {"tuned_bplus", BM_workload_tuned_bplus},
+        {"tuned_batching_bplus", BM_workload_tuned_batching_bplus},
+        {"runtime_bplus", BM_workload_runtime_bplus<1>},
+        {"batching_runtime_bplus_64", BM_workload_runtime_bplus<64>},
+    };
+
+    for (auto [tree, fn] : trees) {
+        for (workload w : all_workloads) {
+            std::string bench_name = std::string("BM_workload_") + tree + "/" + name(w);
+            auto* b = benchmark::RegisterBenchmark(bench_name.c_str(), fn, w);
+            for (int power : {WORKLOAD_POWERS}) {
+                b->Arg(power);
+            }
+        }
+    }
+    return true;
+}();
+
+static constexpr size_t stream_queries = 1 << 20;
+static constexpr size_t stream_chunk = 1 << 12;
+
+// Each iteration streams the next stream_chunk queries through lower_bound_stream<W>. Along with
+// throughput, reports the mean time from a query being taken from the input to its result.
+template <size_t W>
+static void BM_stream_runtime_bplus(benchmark::State& state) {
+    const size_t elements = (1ULL << state.range(0)) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+    auto queries = generate_queries<int>(workload::uniform, data, stream_queries);
+
+    runtime_bplus<> tree(data);
+
+    uint64_t started[stream_chunk];
+    double latency_ticks = 0;
+    size_t offset = 0;
+
+    for (auto _ : state) {
+        size_t i = 0;
+        tree.lower_bound_stream<W>(
+            [&](int& query) {
+                if (i == stream_chunk) {
+                    return false;
+                }
+                started[i] = __rdtsc();
+                query = queries[offset + i++];
+                return true;
+            },
+            [&](size_t ticket, int result) {
+                latency_ticks += __rdtsc() - started[ticket];
+                benchmark::DoNotOptimize(result);
+            });
+
+        offset = (offset + stream_chunk) % stream_queries;
+    }
+
+    state.SetItemsProcessed(state.iterations() * stream_chunk);
+    state.counters["time_per_query"] = benchmark::Counter(state.iterations() * stream_chunk,
+                                                          benchmark::Counter::kIsRate |
+                                                              benchmark::Counter::kInvert);
+    state.counters["latency_ns"] =
+        latency_ticks / tsc_per_ns() / (state.iterations() * stream_chunk);
+}
+
+// The same measurement for lockstep batches of B: every query in a batch waits for the whole
+// batch, so its latency is the batch's.
+template <size_t B>
+static void BM_batch_latency_runtime_bplus(benchmark::State& state) {
+    const size_t elements = (1ULL << state.range(0)) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+    auto queries = generate_queries<int>(workload::uniform, data, stream_queries);
+
+    runtime_bplus<> tree(data);
+
+    int batch_results[B];
+    double latency_ticks = 0;
+    size_t offset = 0;
+
+    for (auto _ : state) {
+        for (size_t batch = 0; batch < stream_chunk; batch += B) {
+            uint64_t started = __rdtsc();
+            tree.lower_bound_batch<B>(&queries[offset + batch], batch_results);
+            benchmark::DoNotOptimize(batch_results);
+            latency_ticks += (__rdtsc() - started) * B;
+        }
+
+        offset = (offset + stream_chunk) % stream_queries;
+    }
+
+    state.SetItemsProcessed(state.iterations() * stream_chunk);
+    state.counters["time_per_query"] = benchmark::Counter(state.iterations() * stream_chunk,
+                                                          benchmark::Counter::kIsRate |
+                                                              benchmark::Counter::kInvert);
+    state.counters["latency_ns"] =
+        latency_ticks / tsc_per_ns() / (state.iterations() * stream_chunk);
+}
+
+// Fills the delta of a tree with range(1) updates, half inserts of new keys and half erases of
+// existing ones, without letting it merge.
+static delta_bplus<> make_delta_tree(benchmark::State& state, std::vector<int>& data) {
+    const size_t power = state.range(0);
+    const size_t delta = state.range(1);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    delta_bplus<> tree(data, SIZE_MAX);
+
+    std::mt19937 rng(54321);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+    std::uniform_int_distribution<size_t> index(0, elements - 1);
+    for (size_t i = 0; i < delta; i++) {
+        if (i % 2) {
+            tree.erase(data[index(rng)]);
+        } else {
+            tree.insert(dist(rng));
+        }
+    }
+
+    return tree;
+}
+
+// Read latency as the delta grows: every lookup also binary searches the inserts and steps over
+// tombstones.
+static void BM_delta_bplus(benchmark::State& state) {
+    std::vector<int> data;
+    delta_bplus<> tree = make_delta_tree(state, data);
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+
+    for (auto _ : state) {
+        int query = dist(rng);
+        benchmark::DoNotOptimize(tree.lower_bound(query));
+        benchmark::ClobberMemory();
+    }
+
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+template <size_t B>
+static void BM_batching_delta_bplus(benchmark::State& state) {
+    std::vector<int> data;
+    delta_bplus<> tree = make_delta_tree(state, data);
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+
+    int batch_queries[B];
+    int batch_results[B];
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        tree.lower_bound_batch<B>(batch_queries, batch_results);
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// The cost of folding a delta of range(1) updates into a base of 2^range(0) bytes of keys.
+static void BM_delta_bplus_merge(benchmark::State& state) {
+    std::vector<int> data;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        delta_bplus<> tree = make_delta_tree(state, data);
+        state.ResumeTiming();
+
+        tree.merge();
+
+        benchmark::DoNotOptimize(tree.base().keys());
+        benchmark::ClobberMemory();
+    }
+}
+
+// Inserts of new keys with the default merge threshold. Each merge is built in the background, so
+// only its start and its swap fall within a write.
+static void BM_delta_bplus_insert(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    delta_bplus<> tree(data);
+
+    std::mt19937 rng(54321);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+
+    for (auto _ : state) {
+        tree.insert(dist(rng));
+        benchmark::ClobberMemory();
+    }
+
+    state.counters["time_per_write"] = benchmark::Counter(
+        state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+static void delta_sweep(benchmark::internal::Benchmark* b) {
+    for (int power : {20, 26}) {
+        for (int delta : {0, 256, 4096, 65536}) {
+            b->Args({power, delta});
+        }
+    }
+}
+
+// Batches of 64 lookups against the packed leaves of compressed_bplus, or the raw leaves of
+// runtime_bplus, over uniform or clustered keys. bytes_per_key is the whole tree's footprint.
+template <bool Compressed, bool Clustered>
+static void BM_leaf_encoding(benchmark::State& state) {
+    constexpr size_t B = 64;
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    std::vector<int> data;
+    if constexpr (Clustered) {
+        data = generate_clustered_data(elements);
+    } else {
+        data = generate_random_data(elements);
+        std::sort(data.begin(), data.end());
+    }
+
+    using tree_type = std::conditional_t<Compressed, compressed_bplus, runtime_bplus<int>>;
+    tree_type tree(data);
+
+    std::mt19937 rng(12345);
+    uniform_distribution<int> dist(data.front(), data.back());
+
+    int batch_queries[B];
+    int batch_results[B];
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        tree.template lower_bound_batch<B>(batch_queries, batch_results);
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * B);
+    state.counters["bytes_per_key"] = static_cast<double>(tree.bytes()) / elements;
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+enum class key_spread { uniform, clustered, skewed };
+
+enum class radix_lookup { descent, radix, batched };
+
+// Lookups of existing keys, from the root or from the node the radix table gives, over keys spread
+// evenly, in dense runs, or bunched towards zero. Skewed keys put most of the tree under a few
+// buckets, which then start near the root. batched is the baseline the table has to beat to be
+// worth having: plain descents, 64 at a time through lower_bound_batch().
+template <radix_lookup Lookup>
+static void BM_radix_runtime_bplus(benchmark::State& state) {
+    constexpr size_t batch_size = Lookup == radix_lookup::batched ? 64 : 1;
+
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    std::vector<int> data;
+    switch (static_cast<key_spread>(state.range(1))) {
+    case key_spread::uniform:
+        data = generate_random_data(elements);
+        std::sort(data.begin(), data.end());
+        break;
+    case key_spread::clustered:
+        data = generate_clustered_data(elements);
+        break;
+    case key_spread::skewed:
+        data = generate_skewed_data(elements);
+        break;
+    }
+
+    runtime_bplus<int> tree(data);
+    if constexpr (Lookup == radix_lookup::radix) {
+        tree.build_radix_root();
+    }
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> pick(0, elements - 1);
+
+    perf_counters counters;
+    counters.start();
+
+    int batch_queries[batch_size];
+    int batch_results[batch_size];
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch_size; i++) {
+            batch_queries[i] = data[pick(rng)];
+        }
+
+        if constexpr (Lookup == radix_lookup::batched) {
+            tree.lower_bound_batch<batch_size>(batch_queries, batch_results);
+        } else if constexpr (Lookup == radix_lookup::radix) {
+            batch_results[0] = tree.lower_bound_radix(batch_queries[0]);
+        } else {
+            batch_results[0] = tree.lower_bound(batch_queries[0]);
+        }
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * batch_size);
+    state.SetItemsProcessed(state.iterations() * batch_size);
+    state.counters["time_per_query"] =
+        benchmark::Counter(state.iterations() * batch_size,
+                           benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+enum class numa_case { local, remote, interleaved, replicated };
+
+// BM_batching_runtime_bplus with the tree's pages bound to the node the benchmark thread is
+// running on, bound to another node, interleaved across all nodes, or replicated onto every node
+// with numa_bplus routing each batch. Remote needs at least two nodes.
+template <size_t B>
+static void BM_numa_runtime_bplus(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+    const auto placement = static_cast<numa_case>(state.range(1));
+
+    int here = numa::current_node();
+    if (placement == numa_case::remote && numa::node_count() == 1) {
+        state.SkipWithError("remote placement needs more than one NUMA node");
+        return;
+    }
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    std::optional<runtime_bplus<int>> placed;
+    std::optional<numa_bplus<int>> replicated;
+    switch (placement) {
+    case numa_case::local:
+        placed.emplace(data, numa::placement::on(here));
+        break;
+    case numa_case::remote:
+        placed.emplace(data, numa::placement::on((here + 1) % numa::node_count()));
+        break;
+    case numa_case::interleaved:
+        placed.emplace(data, numa::placement::interleaved());
+        break;
+    case numa_case::replicated:
+        replicated.emplace(data, numa_bplus<int>::replicate);
+        break;
+    }
+
+    std::mt19937 rng(12345);
+    uniform_distribution<int> dist(data.front(), data.back());
+
+    int batch_queries[B];
+    int batch_results[B];
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        if (placed) {
+            placed->lower_bound_batch<B>(batch_queries, batch_results);
+        } else {
+            replicated->lower_bound_batch<B>(batch_queries, batch_results);
+        }
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * B);
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// BM_batching_runtime_bplus with the internal layers read in place, sharing pages with the leaves,
+// or from their own copy on explicit huge pages. Reports the page size the copy got, since 1GiB and
+// 2MiB pages only come from a reserved hugetlb pool and the fallback is ordinary pages.
+template <size_t B, bool Cached>
+static void BM_inner_layers_runtime_bplus(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<> tree(data);
+    if constexpr (Cached) {
+        state.counters["inner_page_bytes"] = static_cast<double>(tree.cache_inner_layers());
+    }
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+
+    int batch_queries[B];
+    int batch_results[B];
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < B; i++) {
+            batch_queries[i] = dist(rng);
+        }
+
+        tree.lower_bound_batch<B>(batch_queries, batch_results);
+
+        benchmark::DoNotOptimize(batch_results);
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * B);
+    state.SetItemsProcessed(state.iterations() * B);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * B, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// One batch of 2^range(1) random queries per iteration, answered by lower_bound_bulk() or by
+// lower_bound_batch<64>() over it in order, to find the batch size where sorting pays for itself.
+template <bool Bulk>
+static void BM_bulk_runtime_bplus(benchmark::State& state) {
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+    const size_t batch = size_t{1} << state.range(1);
+    constexpr size_t B = 64;
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    runtime_bplus<> tree(data);
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+
+    std::vector<int> queries(batch);
+    std::vector<int> results(batch);
+    for (int& query : queries) {
+        query = dist(rng);
+    }
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        if constexpr (Bulk) {
+            tree.lower_bound_bulk(queries, results);
+        } else {
+            for (size_t i = 0; i < batch; i += B) {
+                tree.lower_bound_batch<B>(&queries[i], &results[i]);
+            }
+        }
+
+        benchmark::DoNotOptimize(results.data());
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations() * batch);
+    state.SetItemsProcessed(state.iterations() * batch);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * batch, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// Readers looking up batches of 64 in a published tree, while a writer thread rebuilds it from
+// fresh keys and publishes it back to back (Swap), or while nothing changes. The benchmark thread
+// is one of range(1) readers and times each of its batches for the latency percentiles; the
+// others only count. Throughput is over all readers.
+template <bool Swap>
+static void BM_published_runtime_bplus(benchmark::State& state) {
+    constexpr size_t B = 64;
+    const size_t power = state.range(0);
+    const size_t elements = (1ULL << power) / sizeof(int);
+    const int readers = state.range(1);
+
+    // Alternating between two key sets keeps the generation and sorting out of the rebuilds.
+    std::vector<int> keys[2];
+    for (auto& k : keys) {
+        k = generate_random_data(elements);
+        std::sort(k.begin(), k.end());
+    }
+    auto queries = generate_random_data(stream_queries);
+
+    published<runtime_bplus<int>> index(std::make_unique<runtime_bplus<int>>(keys[0]));
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> other_batches = 0;
+
+    std::vector<std::thread> threads;
+    if constexpr (Swap) {
+        threads.emplace_back([&] {
+            for (size_t v = 1; !stop.load(std::memory_order_relaxed); v++) {
+                index.publish(std::make_unique<runtime_bplus<int>>(keys[v % 2]));
+            }
+        });
+    }
+    for (int r = 1; r < readers; r++) {
+        threads.emplace_back([&, r] {
+            published<runtime_bplus<int>>::reader reader(index);
+            int results[B];
+            size_t batches = 0;
+            for (size_t offset = r * stream_chunk; !stop.load(std::memory_order_relaxed);
+                 offset = (offset + B) % stream_queries) {
+                reader.get().lower_bound_batch<B>(&queries[offset], results);
+                benchmark::DoNotOptimize(results);
+                reader.quiescent();
+                batches++;
+            }
+            other_batches += batches;
+        });
+    }
+
+    std::vector<uint64_t> latencies;
+    {
+        published<runtime_bplus<int>>::reader reader(index);
+        int results[B];
+        size_t offset = 0;
+
+        for (auto _ : state) {
+            uint64_t started = __rdtsc();
+            reader.get().lower_bound_batch<B>(&queries[offset], results);
+            benchmark::DoNotOptimize(results);
+            reader.quiescent();
+            latencies.push_back(__rdtsc() - started);
+
+            offset = (offset + B) % stream_queries;
+        }
+    }
+
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile_ns = [&](double p) {
+        return latencies[static_cast<size_t>(p * (latencies.size() - 1))] / tsc_per_ns();
+    };
+
+    size_t batches = state.iterations() + other_batches.load();
+    state.SetItemsProcessed(batches * B);
+    state.counters["swaps"] = static_cast<double>(index.version());
+    state.counters["batch_p50_ns"] = percentile_ns(0.5);
+    state.counters["batch_p99_ns"] = percentile_ns(0.99);
+    state.counters["batch_p999_ns"] = percentile_ns(0.999);
+}
+
+static void published_sweep(benchmark::internal::Benchmark* b) {
+    int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    for (int power : {20, 26}) {
+        for (int readers = 1; readers <= cores; readers *= 2) {
+            b->Args({power, readers});
+        }
+    }
+}
+
+enum class string_keys { words, urls };
+
+enum class string_index { lower_bound, prefix32, prefix64, prefix64_batch, hashed };
+
+// Lookups of existing string keys among 2^range(0) of them, either short random words or URLs
+// under one host. std::lower_bound compares whole strings at every step. prefix_bplus searches
+// 4- or 8-byte prefixes and compares strings only to break ties. The hashed index is a
+// runtime_bplus over 32-bit hashes of the keys: the cost of an exact match lookup with no order.
+template <string_index Index>
+static void BM_string_keys(benchmark::State& state) {
+    constexpr size_t B = 64;
+    const size_t elements = size_t{1} << state.range(0);
+    const auto kind = static_cast<string_keys>(state.range(1));
+
+    auto keys =
+        generate_string_data(elements, kind == string_keys::urls ? "https://example.com/" : "");
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> pick(0, elements - 1);
+    std::vector<std::string_view> queries(stream_queries);
+    for (auto& query : queries) {
+        query = keys[pick(rng)];
+    }
+
+    auto hash = [](std::string_view key) {
+        return static_cast<uint32_t>(std::hash<std::string_view>{}(key));
+    };
+
+    std::optional<prefix_bplus<uint32_t>> prefix32;
+    std::optional<prefix_bplus<uint64_t>> prefix64;
+    std::optional<runtime_bplus<uint32_t>> hashed;
+    if constexpr (Index == string_index::prefix32) {
+        prefix32.emplace(keys);
+    } else if constexpr (Index == string_index::prefix64 ||
+                         Index == string_index::prefix64_batch) {
+        prefix64.emplace(keys);
+    } else if constexpr (Index == string_index::hashed) {
+        std::vector<uint32_t> hashes;
+        for (const auto& key : keys) {
+            hashes.push_back(hash(key));
+        }
+        std::sort(hashes.begin(), hashes.end());
+        hashed.emplace(hashes);
+    }
+
+    size_t offset = 0;
+    for (auto _ : state) {
+        if constexpr (Index == string_index::lower_bound) {
+            auto found = std::lower_bound(keys.begin(), keys.end(), queries[offset]);
+            benchmark::DoNotOptimize(found);
+        } else if constexpr (Index == string_index::prefix32) {
+            benchmark::DoNotOptimize(prefix32->lower_bound_rank(queries[offset]));
+        } else if constexpr (Index == string_index::prefix64) {
+            benchmark::DoNotOptimize(prefix64->lower_bound_rank(queries[offset]));
+        } else if constexpr (Index == string_index::prefix64_batch) {
+            size_t ranks[B];
+            prefix64->lower_bound_rank_batch<B>(&queries[offset], ranks);
+            benchmark::DoNotOptimize(ranks);
+        } else {
+            benchmark::DoNotOptimize(hashed->lower_bound_rank(hash(queries[offset])));
+        }
+        benchmark::ClobberMemory();
+
+        offset = (offset + B) % stream_queries;
+    }
+
+    size_t per_iteration = Index == string_index::prefix64_batch ? B : 1;
+    state.SetItemsProcessed(state.iterations() * per_iteration);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations() * per_iteration,
+        benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+enum class probe_into { bitmap, matches, unordered_set };
+
+// Semi-join probes of a 2^20 value column, half of it keys, against a tree of 2^range(0) bytes of
+// keys: into a selection bitmap, into a vector of matching rows, or against a std::unordered_set
+// of the same keys writing the same bitmap.
+template <probe_into Into>
+static void BM_probe_runtime_bplus(benchmark::State& state) {
+    const size_t elements = (1ULL << state.range(0)) / sizeof(int);
+    constexpr size_t column_size = 1 << 20;
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> pick(0, elements - 1);
+    auto column = generate_random_data(column_size);
+    for (size_t i = 0; i < column_size; i += 2) {
+        column[i] = data[pick(rng)];
+    }
+
+    std::optional<runtime_bplus<>> tree;
+    std::optional<std::unordered_set<int>> set;
+    if constexpr (Into == probe_into::unordered_set) {
+        set.emplace(data.begin(), data.end());
+    } else {
+        tree.emplace(data);
+    }
+
+    std::vector<uint64_t> bitmap(column_size / 64);
+    std::vector<size_t> rows;
+    rows.reserve(column_size);
+
+    for (auto _ : state) {
+        if constexpr (Into == probe_into::bitmap) {
+            tree->probe_bitmap(column, bitmap);
+        } else if constexpr (Into == probe_into::matches) {
+            rows.clear();
+            tree->probe_matches(column, rows);
+        } else {
+            for (size_t word = 0; word < bitmap.size(); word++) {
+                uint64_t hits = 0;
+                for (size_t i = 0; i < 64; i++) {
+                    hits |= static_cast<uint64_t>(set->contains(column[word * 64 + i])) << i;
+                }
+                bitmap[word] = hits;
+            }
+        }
+
+        benchmark::DoNotOptimize(bitmap.data());
+        benchmark::DoNotOptimize(rows.data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * column_size);
+    state.counters["time_per_query"] =
+        benchmark::Counter(state.iterations() * column_size,
+                           benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// The process's resident set, from /proc/self/statm.
+static size_t resident_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// range(1) per-partition trees of 2^range(0) keys each, queried round-robin, each either in an
+// allocation of its own or packed into a tree_arena. bytes_per_key is the growth in resident
+// memory over building them all. With transparent huge pages, a tree of its own takes a whole
+// 2MiB page however small it is, so the unpooled runs with 10,000 trees need about 20GB.
+template <bool Pooled>
+static void BM_arena_runtime_bplus(benchmark::State& state) {
+    const size_t keys_per_tree = size_t{1} << state.range(0);
+    const size_t partitions = state.range(1);
+
+    auto data = generate_random_data(keys_per_tree);
+    std::sort(data.begin(), data.end());
+
+    size_t resident_before = resident_bytes();
+
+    std::optional<tree_arena> arena;
+    if constexpr (Pooled) {
+        arena.emplace();
+    }
+
+    std::vector<std::unique_ptr<runtime_bplus<>>> trees;
+    trees.reserve(partitions);
+    for (size_t i = 0; i < partitions; i++) {
+        if constexpr (Pooled) {
+            trees.push_back(std::make_unique<runtime_bplus<>>(data, *arena));
+        } else {
+            trees.push_back(std::make_unique<runtime_bplus<>>(data));
+        }
+    }
+
+    size_t resident_after = resident_bytes();
+    size_t footprint = resident_after > resident_before ? resident_after - resident_before : 0;
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist(data.front(), data.back());
+    size_t next = 0;
+
+    perf_counters counters;
+    counters.start();
+
+    for (auto _ : state) {
+        size_t rank = trees[next]->lower_bound_rank(dist(rng));
+        next = next + 1 == partitions ? 0 : next + 1;
+
+        benchmark::DoNotOptimize(rank);
+        benchmark::ClobberMemory();
+    }
+
+    counters.stop();
+
+    report_perf_counters(state, counters, state.iterations());
+    state.SetItemsProcessed(state.iterations());
+    state.counters["bytes_per_key"] = static_cast<double>(footprint) / (partitions * keys_per_tree);
+    state.counters["time_per_query"] = benchmark::Counter(
+        state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// Runs a benchmark with the node search restricted to one kernel, so that the kernels can be
+// compared side by side over the same sweep.
+template <isa::level L, void (*Benchmark)(benchmark::State&)>
+static void BM_kernel(benchmark::State& state) {
+    isa::level previous = isa::active();
+    if (!isa::select(L)) {
+        state.SkipWithError("kernel not supported on this host");
+        return;
+    }
+
+    Benchmark(state);
+    isa::select(previous);
+}
+
+BENCHMARK(BM_lower_bound)->DenseRange(1, 30);
+BENCHMARK(BM_btree)->DenseRange(1, 30);
+BENCHMARK(BM_bplus)->DenseRange(1, 30);
+BENCHMARK(BM_batching_bplus_4)->DenseRange(1, 30);
+BENCHMARK(BM_batching_bplus_8)->DenseRange(1, 30);
+BENCHMARK(BM_batching_bplus_16)->DenseRange(1, 30);
+BENCHMARK(BM_batching_bplus_32)->DenseRange(1, 30);
+BENCHMARK(BM_batching_bplus_64)->DenseRange(1, 30);
+BENCHMARK(BM_batching_btree<16, false>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_btree<64, false>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_btree<16, true>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_btree<64, true>)->DenseRange(1, 30);
+BENCHMARK(BM_runtime_bplus<int>)->DenseRange(1, 30);
+BENCHMARK(BM_runtime_bplus<int64_t>)->DenseRange(1, 30);
+BENCHMARK(BM_runtime_bplus<uint64_t>)->DenseRange(1, 30);
+BENCHMARK(BM_runtime_bplus<float>)->DenseRange(1, 30);
+BENCHMARK(BM_runtime_bplus<double>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<4>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<8>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<16>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<32>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<64>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<64, int64_t>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<64, uint64_t>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<64, float>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus<64, double>)->DenseRange(1, 30);
+BENCHMARK(BM_vertical_runtime_bplus<16, false>)->DenseRange(2, 30);
+BENCHMARK(BM_vertical_runtime_bplus<32, false>)->DenseRange(2, 30);
+BENCHMARK(BM_vertical_runtime_bplus<64, false>)->DenseRange(2, 30);
+BENCHMARK(BM_vertical_runtime_bplus<16, true>)->DenseRange(2, 30);
+BENCHMARK(BM_vertical_runtime_bplus<32, true>)->DenseRange(2, 30);
+BENCHMARK(BM_vertical_runtime_bplus<64, true>)->DenseRange(2, 30);
+BENCHMARK(BM_batching_runtime_bplus_rank<16>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus_rank<64>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus_value<16>)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus_value<64>)->DenseRange(1, 30);
+BENCHMARK(BM_parallel_runtime_bplus<64>)->Apply(parallel_sweep)->UseRealTime();
+BENCHMARK(BM_count_lower_bound)->DenseRange(1, 30);
+BENCHMARK(BM_runtime_bplus_count)->DenseRange(1, 30);
+BENCHMARK(BM_batching_runtime_bplus_count<64>)->DenseRange(1, 30);
+BENCHMARK(BM_runtime_bplus_build)
+    ->Apply(build_sweep)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_runtime_bplus_build_streaming)
+    ->DenseRange(10, 30, 2)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_runtime_bplus_build_cold)
+    ->DenseRange(20, 30, 2)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime()
+    ->Iterations(5);
+BENCHMARK(BM_runtime_bplus_open_cold<false>)
+    ->DenseRange(20, 30, 2)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime()
+    ->Iterations(5);
+BENCHMARK(BM_runtime_bplus_open_cold<true>)
+    ->DenseRange(20, 30, 2)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime()
+    ->Iterations(5);
+BENCHMARK(BM_stream_runtime_bplus<8>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_stream_runtime_bplus<16>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_stream_runtime_bplus<32>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_batch_latency_runtime_bplus<16>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_batch_latency_runtime_bplus<64>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_delta_bplus)->Apply(delta_sweep);
+BENCHMARK(BM_batching_delta_bplus<64>)->Apply(delta_sweep);
+BENCHMARK(BM_delta_bplus_merge)
+    ->ArgsProduct({{20, 24, 28}, {256, 65536}})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK(BM_delta_bplus_insert)->Arg(20)->Arg(26);
+BENCHMARK(BM_leaf_encoding<false, false>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_leaf_encoding<true, false>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_leaf_encoding<false, true>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_leaf_encoding<true, true>)->DenseRange(12, 30, 2);
+BENCHMARK(BM_radix_runtime_bplus<radix_lookup::descent>)
+    ->ArgsProduct({{20, 22, 24, 26, 28, 30}, {0, 1, 2}});
+BENCHMARK(BM_radix_runtime_bplus<radix_lookup::radix>)
+    ->ArgsProduct({{20, 22, 24, 26, 28, 30}, {0, 1, 2}});
+BENCHMARK(BM_radix_runtime_bplus<radix_lookup::batched>)
+    ->ArgsProduct({{20, 22, 24, 26, 28, 30}, {0, 1, 2}});
+BENCHMARK(BM_numa_runtime_bplus<64>)->ArgsProduct({{20, 26, 30}, {0, 1, 2, 3}});
+BENCHMARK(BM_inner_layers_runtime_bplus<1, false>)->DenseRange(20, 30, 2);
+BENCHMARK(BM_inner_layers_runtime_bplus<1, true>)->DenseRange(20, 30, 2);
+BENCHMARK(BM_inner_layers_runtime_bplus<64, false>)->DenseRange(20, 30, 2);
+BENCHMARK(BM_inner_layers_runtime_bplus<64, true>)->DenseRange(20, 30, 2);
+BENCHMARK(BM_bulk_runtime_bplus<false>)
+    ->ArgsProduct({{20, 26, 30}, benchmark::CreateDenseRange(6, 20, 2)});
+BENCHMARK(BM_bulk_runtime_bplus<true>)
+    ->ArgsProduct({{20, 26, 30}, benchmark::CreateDenseRange(6, 20, 2)});
+BENCHMARK(BM_published_runtime_bplus<false>)->Apply(published_sweep)->UseRealTime();
+BENCHMARK(BM_published_runtime_bplus<true>)->Apply(published_sweep)->UseRealTime();
+BENCHMARK(BM_string_keys<string_index::lower_bound>)->ArgsProduct({{10, 14, 18, 22}, {0, 1}});
+BENCHMARK(BM_string_keys<string_index::prefix32>)->ArgsProduct({{10, 14, 18, 22}, {0, 1}});
+BENCHMARK(BM_string_keys<string_index::prefix64>)->ArgsProduct({{10, 14, 18, 22}, {0, 1}});
+BENCHMARK(BM_string_keys<string_index::prefix64_batch>)->ArgsProduct({{10, 14, 18, 22}, {0, 1}});
+BENCHMARK(BM_string_keys<string_index::hashed>)->ArgsProduct({{10, 14, 18, 22}, {0, 1}});
+BENCHMARK(BM_probe_runtime_bplus<probe_into::bitmap>)->DenseRange(12, 28, 4);
+BENCHMARK(BM_probe_runtime_bplus<probe_into::matches>)->DenseRange(12, 28, 4);
+BENCHMARK(BM_probe_runtime_bplus<probe_into::unordered_set>)->DenseRange(12, 28, 4);
+BENCHMARK(BM_arena_runtime_bplus<false>)->ArgsProduct({{10, 12, 14, 16}, {1000, 10000}});
+BENCHMARK(BM_arena_runtime_bplus<true>)->ArgsProduct({{10, 12, 14, 16}, {1000, 10000}});
+
+using isa::level;
+BENCHMARK(BM_kernel<level::scalar, BM_btree>)->Name("BM_btree_scalar")->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx2, BM_btree>)->Name("BM_btree_avx2")->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx512, BM_btree>)->Name("BM_btree_avx512")->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::scalar, BM_bplus<>>)->Name("BM_bplus_scalar")->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx2, BM_bplus<>>)->Name("BM_bplus_avx2")->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx512, BM_bplus<>>)->Name("BM_bplus_avx512")->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::scalar, BM_batching_bplus_64<>>)
+    ->Name("BM_batching_bplus_64_scalar")
+    ->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx2, BM_batching_bplus_64<>>)
+    ->Name("BM_batching_bplus_64_avx2")
+    ->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx512, BM_batching_bplus_64<>>)
+    ->Name("BM_batching_bplus_64_avx512")
+    ->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::scalar, BM_runtime_bplus<int>>)
+    ->Name("BM_runtime_bplus_scalar")
+    ->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx2, BM_runtime_bplus<int>>)
+    ->Name("BM_runtime_bplus_avx2")
+    ->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx512, BM_runtime_bplus<int>>)
+    ->Name("BM_runtime_bplus_avx512")
+    ->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::scalar, BM_batching_runtime_bplus<64>>)
+    ->Name("BM_batching_runtime_bplus_64_scalar")
+    ->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx2, BM_batching_runtime_bplus<64>>)
+    ->Name("BM_batching_runtime_bplus_64_avx2")
+    ->DenseRange(1, 30);
+BENCHMARK(BM_kernel<level::avx512, BM_batching_runtime_bplus<64>>)
+    ->Name("BM_batching_runtime_bplus_64_avx512")
+    ->DenseRange(1, 30);
 
 BENCHMARK_MAIN();
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <climits>
+#include <cmath>
+#include <limits>
 #include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 namespace constants {
@@ -11,14 +17,85 @@ inline constexpr int block_len = 16;
 
 }  // namespace constants
 
-inline std::vector<int> generate_random_data(size_t n) {
+template <typename T>
+using uniform_distribution = std::conditional_t<std::is_floating_point_v<T>,
+                                                std::uniform_real_distribution<T>,
+                                                std::uniform_int_distribution<T>>;
+
+// int keys are drawn from [0, INT_MAX] as they always have been. Other integer types use their
+// full range, and floating point keys [-1e9, 1e9], so that sign handling is exercised.
+template <typename T = int>
+inline std::vector<T> generate_random_data(size_t n) {
     std::random_device rd;
     std::mt19937 gen(rd());
-    std::uniform_int_distribution<int> dis(0, INT_MAX);
 
-    std::vector<int> data(n);
+    uniform_distribution<T> dis;
+    if constexpr (std::is_same_v<T, int>) {
+        dis = uniform_distribution<T>(0, INT_MAX);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        dis = uniform_distribution<T>(-1e9, 1e9);
+    } else {
+        dis = uniform_distribution<T>(std::numeric_limits<T>::lowest(),
+                                      std::numeric_limits<T>::max());
+    }
+
+    std::vector<T> data(n);
     for (size_t i = 0; i < n; i++) {
         data[i] = dis(gen);
     }
     return data;
 }
+
+// Sorted int keys in dense runs, as auto-increment IDs or timestamps from many sources would be:
+// runs of run_len keys 1 to 8 apart, starting at uniformly random points in [0, INT_MAX].
+inline std::vector<int> generate_clustered_data(size_t n, size_t run_len = 256) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<int> start(0, INT_MAX - static_cast<int>(run_len) * 8);
+    std::uniform_int_distribution<int> gap(1, 8);
+
+    std::vector<int> data(n);
+    for (size_t i = 0; i < n; i += run_len) {
+        int key = start(gen);
+        for (size_t j = i; j < std::min(i + run_len, n); j++) {
+            data[j] = key;
+            key += gap(gen);
+        }
+    }
+    std::sort(data.begin(), data.end());
+    return data;
+}
+
+// Sorted int keys bunched towards zero, u^8 * INT_MAX for uniform u, so half of them are below
+// INT_MAX / 256. Anything that models keys as evenly spread does badly on these.
+inline std::vector<int> generate_skewed_data(size_t n) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<double> unit;
+
+    std::vector<int> data(n);
+    for (int& key : data) {
+        key = static_cast<int>(std::pow(unit(gen), 8) * INT_MAX);
+    }
+    std::sort(data.begin(), data.end());
+    return data;
+}
+
+// Sorted string keys: prefix followed by 4 to 24 random lowercase letters, such as URLs under one
+// host with prefix "https://example.com/". There may be duplicates.
+inline std::vector<std::string> generate_string_data(size_t n, std::string_view prefix = "") {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<int> length(4, 24);
+    std::uniform_int_distribution<int> letter('a', 'z');
+
+    std::vector<std::string> data(n);
+    for (std::string& key : data) {
+        key = prefix;
+        for (int i = length(gen); i > 0; i--) {
+            key.push_back(static_cast<char>(letter(gen)));
+        }
+    }
+    std::sort(data.begin(), data.end());
+    return data;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <initializer_list>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// Anonymous memory explicitly backed by huge pages from the hugetlb pool, rather than hinted at
+// with MADV_HUGEPAGE, which quietly does nothing when transparent huge pages are off. The pool has
+// to be reserved first (vm.nr_hugepages, or hugepages=N on the kernel command line for 1GiB
+// pages), so every step falls back: 1GiB pages, then 2MiB, then ordinary pages with the hint.
+namespace huge_pages {
+
+inline constexpr size_t page_2m = size_t{1} << 21;
+inline constexpr size_t page_1g = size_t{1} << 30;
+
+struct options {
+    size_t largest = page_1g;  // the largest page size to try
+    bool lock = false;         // mlock: keep the pages resident, if RLIMIT_MEMLOCK allows
+};
+
+// A mapping and the size of the pages actually behind it. Ordinary pages are reported as the base
+// page size, even if THP later backs them with huge pages anyway.
+struct region {
+    void* addr = nullptr;
+    size_t bytes = 0;
+    size_t page_bytes = 0;
+    bool locked = false;
+};
+
+// Maps at least bytes, rounded up to the page size obtained. Huge pages are faulted in up front,
+// since the pool may run dry later. Returns an empty region only if even the ordinary mapping
+// failed.
+inline region map(size_t bytes, options opts = {}) noexcept {
+    for (size_t page : {page_1g, page_2m}) {
+        if (page > opts.largest) {
+            continue;
+        }
+
+        size_t rounded = (bytes + page - 1) / page * page;
+        int log2_page = __builtin_ctzll(page);
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (log2_page << MAP_HUGE_SHIFT);
+
+        void* addr = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, flags | MAP_POPULATE, -1, 0);
+        if (addr != MAP_FAILED) {
+            return {addr, rounded, page, opts.lock && mlock(addr, rounded) == 0};
+        }
+    }
+
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t rounded = (bytes + page_2m - 1) / page_2m * page_2m;
+    void* addr = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if (addr == MAP_FAILED) {
+        return {};
+    }
+
+    madvise(addr, rounded, MADV_HUGEPAGE);
+    return {addr, rounded, page, opts.lock && mlock(addr, rounded) == 0};
+}
+
+inline void unmap(const region& r) noexcept {
+    if (r.addr != nullptr) {
+        munmap(r.addr, r.bytes);
+    }
+}
+
+}  // namespace huge_pages
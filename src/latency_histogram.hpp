@@ -0,0 +1,84 @@
+#pragma once
+
+#include <x86intrin.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+// TSC ticks per nanosecond, measured once against the steady clock.
+inline double tsc_per_ns() {
+    static const double ratio = [] {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t start_tsc = __rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t ticks = __rdtsc() - start_tsc;
+        return ticks / std::chrono::duration<double, std::nano>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    }();
+    return ratio;
+}
+
+// Counts of latencies in TSC ticks, bucketed the way HdrHistogram does it: exactly below 32, and
+// above that each power of two split into 32 linear sub-buckets, so any value is within about 3%
+// of its bucket's bounds. Recording is a lzcnt, a shift and an increment, and the whole thing is
+// 15KB whatever the range.
+class latency_histogram {
+public:
+    void record(uint64_t ticks, uint64_t count = 1) noexcept {
+        _counts[bucket(ticks)] += count;
+        _total += count;
+    }
+
+    uint64_t count() const noexcept {
+        return _total;
+    }
+
+    // The smallest bucket upper bound that at least a fraction p of the recorded latencies are at
+    // or below, in ticks. 0 if nothing was recorded.
+    uint64_t percentile(double p) const noexcept {
+        if (_total == 0) {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(p * (_total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < buckets; b++) {
+            seen += _counts[b];
+            if (seen >= rank) {
+                return highest(b);
+            }
+        }
+        return highest(buckets - 1);
+    }
+
+private:
+    static constexpr int sub_bits = 5;
+    static constexpr uint64_t sub_buckets = uint64_t{1} << sub_bits;
+    static constexpr size_t buckets = (64 - sub_bits + 1) * sub_buckets;
+
+    uint64_t _counts[buckets] = {};
+    uint64_t _total = 0;
+
+    static size_t bucket(uint64_t ticks) noexcept {
+        if (ticks < sub_buckets) {
+            return ticks;
+        }
+
+        int exponent = 63 - __builtin_clzll(ticks);
+        uint64_t sub = (ticks >> (exponent - sub_bits)) & (sub_buckets - 1);
+        return (exponent - sub_bits + 1) * sub_buckets + sub;
+    }
+
+    static uint64_t highest(size_t b) noexcept {
+        if (b < sub_buckets) {
+            return b;
+        }
+
+        int exponent = static_cast<int>(b / sub_buckets) + sub_bits - 1;
+        uint64_t lowest = (sub_buckets + b % sub_buckets) << (exponent - sub_bits);
+        return lowest + (uint64_t{1} << (exponent - sub_bits)) - 1;
+    }
+};
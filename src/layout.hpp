@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// A node layout picked by ./profile tune, which writes every layout it timed to a CSV with the
+// columns name,size,width,batch,ns_per_query,chosen, where size is the data size as a power of two
+// bytes and chosen is 1 on the fastest layout of each tree and size.
+struct tuned_layout {
+    int width;
+    size_t batch;  // 1 for bplus
+};
+
+// The layout chosen for tree at 2^power bytes in the CSV at path, or nothing if either the file or
+// a chosen row for that tree and size is missing.
+inline std::optional<tuned_layout> read_tuned_layout(const std::string& path, std::string_view tree,
+                                                     size_t power) {
+    std::ifstream csv(path);
+    std::string line;
+    std::getline(csv, line);  // the column names
+
+    while (std::getline(csv, line)) {
+        std::istringstream row(line);
+        std::string name, size, width, batch, ns_per_query, chosen;
+        std::getline(row, name, ',');
+        std::getline(row, size, ',');
+        std::getline(row, width, ',');
+        std::getline(row, batch, ',');
+        std::getline(row, ns_per_query, ',');
+        std::getline(row, chosen, ',');
+
+        if (name == tree && chosen == "1" && std::stoul(size) == power) {
+            return tuned_layout{std::stoi(width), std::stoul(batch)};
+        }
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+// Just enough NUMA to place a tree's memory, using the mbind system call directly so there is no
+// dependency on libnuma. Everything here is best effort: on a single node host, or where the
+// kernel refuses, memory is simply left to the default first touch policy.
+namespace numa {
+
+// The number of nodes, from the kernel's "0-N" range of online nodes.
+inline int node_count() {
+    static const int count = [] {
+        std::ifstream file("/sys/devices/system/node/online");
+        std::string online;
+        if (!(file >> online)) {
+            return 1;
+        }
+
+        size_t dash = online.find_last_of("-,");
+        return dash == std::string::npos ? 1 : std::stoi(online.substr(dash + 1)) + 1;
+    }();
+    return count;
+}
+
+// The node of the CPU the calling thread is running on right now. glibc's getcpu() goes through
+// the vDSO (or rseq), so this costs a few nanoseconds rather than a trip into the kernel.
+inline int current_node() noexcept {
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (getcpu(&cpu, &node) != 0) {
+        return 0;
+    }
+    return static_cast<int>(node);
+}
+
+// Where the pages of an allocation should live.
+struct placement {
+    enum policy_kind { first_touch, bind, interleave };
+
+    policy_kind policy = first_touch;
+    int node = 0;  // for bind
+
+    static placement on(int node) noexcept {
+        return {bind, node};
+    }
+
+    static placement interleaved() noexcept {
+        return {interleave, 0};
+    }
+};
+
+// Applies the placement to [addr, addr + bytes), which must be page aligned. Pages already faulted
+// in are migrated. Returns false if the kernel refused.
+inline bool place(void* addr, size_t bytes, placement where) noexcept {
+    if (where.policy == placement::first_touch) {
+        return true;
+    }
+
+    int nodes = node_count();
+    if (nodes > 64 || where.node < 0 || where.node >= nodes) {
+        return false;
+    }
+
+    unsigned long all = nodes == 64 ? ~0UL : (1UL << nodes) - 1;
+    unsigned long mask = where.policy == placement::bind ? 1UL << where.node : all;
+    int mode = where.policy == placement::bind ? MPOL_BIND : MPOL_INTERLEAVE;
+
+    // maxnode counts bits, and the kernel expects one more than the highest it should read.
+    return syscall(SYS_mbind, addr, bytes, mode, &mask, sizeof(mask) * 8 + 1, MPOL_MF_MOVE) == 0;
+}
+
+}  // namespace numa
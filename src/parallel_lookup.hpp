@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+
+#include "thread_pool.hpp"
+
+// Splits a large query array into B-sized batches and runs them across a thread pool. The tree is
+// read-only during lookups, so the workers share it without synchronisation; each one writes only
+// the results of the batches it claimed.
+//
+// batch(queries, results) must process exactly B queries. A trailing partial batch is padded by
+// repeating the last query into a local buffer, so callers need not round their arrays up.
+template <size_t B, typename Q, typename R, typename F>
+void parallel_batches(thread_pool& pool, std::span<const Q> queries, std::span<R> results,
+                      F&& batch) {
+    size_t full = queries.size() / B;
+    size_t total = (queries.size() + B - 1) / B;
+
+    pool.parallel_for(total, [&](size_t b) {
+        if (b < full) {
+            batch(queries.data() + b * B, results.data() + b * B);
+            return;
+        }
+
+        size_t remaining = queries.size() - b * B;
+
+        Q batch_queries[B];
+        R batch_results[B];
+        std::copy_n(queries.data() + b * B, remaining, batch_queries);
+        std::fill(batch_queries + remaining, batch_queries + B, queries.back());
+
+        batch(batch_queries, batch_results);
+        std::copy_n(batch_results, remaining, results.data() + b * B);
+    });
+}
+
+// The lower bound of every query, as tree.lower_bound_batch<B>() would give it.
+template <size_t B, typename Tree, typename T = typename Tree::key_type>
+void lower_bound_parallel(thread_pool& pool, const Tree& tree,
+                          std::span<const std::type_identity_t<T>> queries,
+                          std::span<std::type_identity_t<T>> results) {
+    parallel_batches<B>(pool, queries, results, [&](const T* batch_queries, T* batch_results) {
+        tree.template lower_bound_batch<B>(batch_queries, batch_results);
+    });
+}
+
+// The rank of the lower bound of every query, as tree.lower_bound_rank_batch<B>() would give it.
+template <size_t B, typename Tree, typename T = typename Tree::key_type>
+void lower_bound_rank_parallel(thread_pool& pool, const Tree& tree,
+                               std::span<const std::type_identity_t<T>> queries,
+                               std::span<size_t> ranks) {
+    parallel_batches<B>(pool, queries, ranks, [&](const T* batch_queries, size_t* batch_ranks) {
+        tree.template lower_bound_rank_batch<B>(batch_queries, batch_ranks);
+    });
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+
+// Hardware counters for the calling thread, read in process with perf_event_open, so that a
+// benchmark or profile can count just its query loop rather than the whole binary.
+//
+// Only user space is counted, which works at the default perf_event_paranoid of 2 without sudo.
+// Each event is opened on its own rather than as a group, so one the PMU can't provide (common
+// under virtualisation) is simply missing rather than taking the others with it. If the kernel
+// multiplexes events, counts are scaled up by enabled / running time.
+class perf_counters {
+public:
+    enum event { cycles, instructions, l1d_misses, llc_misses, dtlb_misses, branch_misses, count };
+
+    static constexpr const char* names[count] = {
+        "cycles", "instructions", "L1D_misses", "LLC_misses", "dTLB_misses", "branch_misses",
+    };
+
+    perf_counters() {
+        for (int e = 0; e < count; e++) {
+            _fds[e] = open(static_cast<event>(e));
+        }
+    }
+
+    ~perf_counters() {
+        for (int fd : _fds) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    // Zeroes and starts every available counter.
+    void start() noexcept {
+        for (int fd : _fds) {
+            if (fd != -1) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void stop() noexcept {
+        for (int fd : _fds) {
+            if (fd != -1) {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+    }
+
+    // The count between the last start() and stop(), or nothing if the event is unavailable.
+    std::optional<double> operator[](event e) const noexcept {
+        struct {
+            uint64_t value;
+            uint64_t time_enabled;
+            uint64_t time_running;
+        } reading;
+
+        if (_fds[e] == -1 || read(_fds[e], &reading, sizeof(reading)) != sizeof(reading) ||
+            reading.time_running == 0) {
+            return std::nullopt;
+        }
+
+        double scale = static_cast<double>(reading.time_enabled) / reading.time_running;
+        return reading.value * scale;
+    }
+
+    bool available() const noexcept {
+        for (int fd : _fds) {
+            if (fd != -1) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Prints each available count divided by the number of queries.
+    void print(size_t queries) const {
+        for (int e = 0; e < count; e++) {
+            if (auto value = (*this)[static_cast<event>(e)]) {
+                printf("%16.2f %s per query\n", *value / queries, names[e]);
+            } else {
+                printf("%16s %s per query\n", "<unavailable>", names[e]);
+            }
+        }
+    }
+
+    // Counts for as long as it is in scope.
+    class scope {
+    public:
+        explicit scope(perf_counters& counters) : _counters(counters) {
+            _counters.start();
+        }
+
+        ~scope() {
+            _counters.stop();
+        }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        perf_counters& _counters;
+    };
+
+private:
+    int _fds[count];
+
+    static int open(event e) noexcept {
+        perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        switch (e) {
+        case cycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case instructions:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case l1d_misses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_L1D);
+            break;
+        case llc_misses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_LL);
+            break;
+        case dtlb_misses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB);
+            break;
+        default:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        }
+
+        // This thread, any CPU.
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static uint64_t cache_miss(uint64_t cache) noexcept {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+};
@@ -3,14 +3,19 @@
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <random>
 #include <vector>
 
 #include "common.hpp"
+#include "latency_histogram.hpp"
+#include "perf_counters.hpp"
+#include "trees/isa.hpp"
 #include "trees/batching_bplus.hpp"
 #include "trees/bplus.hpp"
 #include "trees/btree.hpp"
+#include "trees/runtime_bplus.hpp"
 
 constexpr size_t num_queries = (1 << 28);
 constexpr size_t num_elements = (1 << 28) / sizeof(int);
@@ -61,22 +66,58 @@ int profile_batching_bplus(const std::vector<int>& data) {
     printf("Profile begins: batching_bplus\n");
 
     int sink = 0;
+    perf_counters counters;
 
-    for (size_t i = 0; i < num_queries; i += batch_size) {
-        int batch_queries[batch_size];
-        int batch_results[batch_size];
+    {
+        perf_counters::scope counting(counters);
+        for (size_t i = 0; i < num_queries; i += batch_size) {
+            int batch_queries[batch_size];
+            int batch_results[batch_size];
 
-        for (size_t j = 0; j < batch_size; j++) {
-            batch_queries[j] = dist(rng);
+            for (size_t j = 0; j < batch_size; j++) {
+                batch_queries[j] = dist(rng);
+            }
+
+            tree.lower_bound_batch(batch_queries, batch_results);
+
+            for (size_t j = 0; j < batch_size; j++) {
+                sink += batch_results[j];
+            }
         }
+    }
+
+    counters.print(num_queries);
+    return sink;
+}
+
+int profile_runtime_bplus(const std::vector<int>& data) {
+    constexpr int batch_size = 64;
+
+    runtime_bplus<> tree(data);
+    printf("Profile begins: runtime_bplus\n");
+
+    int sink = 0;
+    perf_counters counters;
 
-        tree.lower_bound_batch(batch_queries, batch_results);
+    {
+        perf_counters::scope counting(counters);
+        for (size_t i = 0; i < num_queries; i += batch_size) {
+            int batch_queries[batch_size];
+            int batch_results[batch_size];
 
-        for (size_t j = 0; j < batch_size; j++) {
-            sink += batch_results[j];
+            for (size_t j = 0; j < batch_size; j++) {
+                batch_queries[j] = dist(rng);
+            }
+
+            tree.lower_bound_batch<batch_size>(batch_queries, batch_results);
+
+            for (size_t j = 0; j < batch_size; j++) {
+                sink += batch_results[j];
+            }
         }
     }
 
+    counters.print(num_queries);
     return sink;
 }
 
@@ -85,11 +126,16 @@ int profile_bplus(const std::vector<int>& data) {
     printf("Profile begins: bplus\n");
 
     int sink = 0;
+    perf_counters counters;
 
-    for (size_t i = 0; i < num_queries; i++) {
-        sink += tree.lower_bound(dist(rng));
+    {
+        perf_counters::scope counting(counters);
+        for (size_t i = 0; i < num_queries; i++) {
+            sink += tree.lower_bound(dist(rng));
+        }
     }
 
+    counters.print(num_queries);
     return sink;
 }
 
@@ -98,11 +144,16 @@ int profile_btree(const std::vector<int>& data) {
     printf("Profile begins: btree\n");
 
     int sink = 0;
+    perf_counters counters;
 
-    for (size_t i = 0; i < num_queries; i++) {
-        sink += tree.lower_bound(dist(rng));
+    {
+        perf_counters::scope counting(counters);
+        for (size_t i = 0; i < num_queries; i++) {
+            sink += tree.lower_bound(dist(rng));
+        }
     }
 
+    counters.print(num_queries);
     return sink;
 }
 
@@ -110,17 +161,263 @@ int profile_lower_bound(const std::vector<int>& data) {
     printf("Profile begins: std::lower_bound\n");
 
     int sink = 0;
+    perf_counters counters;
+
+    {
+        perf_counters::scope counting(counters);
+        for (size_t i = 0; i < num_queries; i++) {
+            sink += *std::lower_bound(data.begin(), data.end(), dist(rng));
+        }
+    }
+
+    counters.print(num_queries);
+    return sink;
+}
+
+// Latency mode: every lookup (or batch) is timed with rdtscp and filed in a histogram per tree and
+// data size, rather than counted in aggregate.
+constexpr size_t latency_queries = 1 << 22;
+
+// The percentiles written for each tree and size: dense enough to draw a CDF, with the tail.
+constexpr double latency_percentiles[] = {
+    0.01, 0.05, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 0.95, 0.99,
+    0.995, 0.999, 0.9995, 0.9999, 1.0,
+};
+
+// rdtscp waits for the work before it to finish, and the lfence stops the work after it starting
+// early.
+inline uint64_t ticks_now() {
+    unsigned aux;
+    uint64_t ticks = __rdtscp(&aux);
+    _mm_lfence();
+    return ticks;
+}
+
+void report_latency(std::ofstream& csv, const char* tree, size_t power,
+                    const latency_histogram& hist) {
+    double per_ns = tsc_per_ns();
+    printf("%16s 2^%-2zu p50 %8.1f ns  p99 %8.1f ns  p999 %8.1f ns\n", tree, power,
+           hist.percentile(0.5) / per_ns, hist.percentile(0.99) / per_ns,
+           hist.percentile(0.999) / per_ns);
+
+    for (double p : latency_percentiles) {
+        csv << tree << ',' << power << ',' << p << ',' << hist.percentile(p) / per_ns << '\n';
+    }
+}
+
+// Times btree and bplus per lookup, and batching_bplus per batch of 64. Every query in a batch is
+// charged the whole batch, as none of them has its answer any sooner.
+template <size_t power>
+int record_latency(std::ofstream& csv) {
+    constexpr size_t elements = (1ULL << power) / sizeof(int);
+    constexpr size_t batch_size = 64;
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+    std::uniform_int_distribution<int> keys(data.front(), data.back());
+
+    int sink = 0;
+
+    {
+        btree tree(data);
+        latency_histogram hist;
+        for (size_t i = 0; i < latency_queries; i++) {
+            int query = keys(rng);
+            uint64_t started = ticks_now();
+            sink += tree.lower_bound(query);
+            hist.record(ticks_now() - started);
+        }
+        report_latency(csv, "btree", power, hist);
+    }
+
+    {
+        bplus<elements> tree(data);
+        latency_histogram hist;
+        for (size_t i = 0; i < latency_queries; i++) {
+            int query = keys(rng);
+            uint64_t started = ticks_now();
+            sink += tree.lower_bound(query);
+            hist.record(ticks_now() - started);
+        }
+        report_latency(csv, "bplus", power, hist);
+    }
+
+    {
+        batching_bplus<elements, batch_size> tree(data);
+        latency_histogram hist;
+        for (size_t i = 0; i < latency_queries; i += batch_size) {
+            int batch_queries[batch_size];
+            int batch_results[batch_size];
+            for (size_t j = 0; j < batch_size; j++) {
+                batch_queries[j] = keys(rng);
+            }
+
+            uint64_t started = ticks_now();
+            tree.lower_bound_batch(batch_queries, batch_results);
+            hist.record(ticks_now() - started, batch_size);
+
+            sink += batch_results[0];
+        }
+        report_latency(csv, "batching_bplus", power, hist);
+    }
+
+    return sink;
+}
+
+template <size_t... powers>
+int record_latencies(const char* path) {
+    std::ofstream csv(path);
+    if (!csv) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    csv << "name,size,percentile,latency_ns\n";
+    return (record_latency<powers>(csv) + ...);
+}
+
+// Tune mode: times bplus at each node width, and batching_bplus at each width and batch size, at
+// data sizes from 2^12 to 2^28 bytes, and picks the fastest layout of each tree for each size.
+// Which one wins depends on the host's cache and TLB sizes, so run it on each of them. The tuned
+// workload benchmarks read the choices back through layout.hpp.
+constexpr size_t tune_queries = 1 << 22;
+constexpr size_t tune_query_pool = 1 << 20;
+
+struct layout {
+    const char* tree;
+    int width;
+    size_t batch;  // 1 for bplus
+    double ns_per_query;
+};
+
+// Nanoseconds per query over tune_queries queries, after a pass over a sixteenth as many to warm
+// the caches and TLB up. lookup(i) answers queries from i onwards and returns how many it did.
+template <typename Lookup>
+double time_queries(Lookup&& lookup) {
+    for (size_t i = 0; i < tune_queries / 16;) {
+        i += lookup(i);
+    }
+
+    uint64_t started = ticks_now();
+    for (size_t i = 0; i < tune_queries;) {
+        i += lookup(i);
+    }
+    return (ticks_now() - started) / tsc_per_ns() / tune_queries;
+}
+
+template <size_t power, int Width>
+int tune_bplus(std::vector<layout>& sweep, const std::vector<int>& data,
+               const std::vector<int>& queries) {
+    bplus<(1ULL << power) / sizeof(int), int, Width> tree(data);
+
+    int sink = 0;
+    double ns = time_queries([&](size_t i) {
+        sink += tree.lower_bound(queries[i % tune_query_pool]);
+        return size_t{1};
+    });
+
+    sweep.push_back({"bplus", Width, 1, ns});
+    return sink;
+}
+
+template <size_t power, int Width, size_t B>
+int tune_batching_bplus(std::vector<layout>& sweep, const std::vector<int>& data,
+                        const std::vector<int>& queries) {
+    batching_bplus<(1ULL << power) / sizeof(int), B, int, Width> tree(data);
+
+    int sink = 0;
+    double ns = time_queries([&](size_t i) {
+        int results[B];
+        tree.lower_bound_batch(&queries[i % tune_query_pool], results);
+        sink += results[0];
+        return B;
+    });
+
+    sweep.push_back({"batching_bplus", Width, B, ns});
+    return sink;
+}
+
+template <size_t power, int Width>
+int tune_batch_sizes(std::vector<layout>& sweep, const std::vector<int>& data,
+                     const std::vector<int>& queries) {
+    return tune_batching_bplus<power, Width, 8>(sweep, data, queries) +
+           tune_batching_bplus<power, Width, 16>(sweep, data, queries) +
+           tune_batching_bplus<power, Width, 32>(sweep, data, queries) +
+           tune_batching_bplus<power, Width, 64>(sweep, data, queries);
+}
 
-    for (size_t i = 0; i < num_queries; i++) {
-        sink += *std::lower_bound(data.begin(), data.end(), dist(rng));
+// Writes every layout of one tree timed at this size, marking and printing the fastest.
+void report_layouts(std::ofstream& csv, size_t power, const std::vector<layout>& sweep) {
+    auto best = std::min_element(sweep.begin(), sweep.end(), [](const layout& a, const layout& b) {
+        return a.ns_per_query < b.ns_per_query;
+    });
+
+    printf("%16s 2^%-2zu width %2d  batch %2zu  %8.2f ns\n", best->tree, power, best->width,
+           best->batch, best->ns_per_query);
+
+    for (auto l = sweep.begin(); l != sweep.end(); l++) {
+        csv << l->tree << ',' << power << ',' << l->width << ',' << l->batch << ','
+            << l->ns_per_query << ',' << (l == best) << '\n';
     }
+}
+
+template <size_t power>
+int tune_layout(std::ofstream& csv) {
+    constexpr size_t elements = (1ULL << power) / sizeof(int);
+
+    auto data = generate_random_data(elements);
+    std::sort(data.begin(), data.end());
+
+    std::uniform_int_distribution<int> keys(data.front(), data.back());
+    std::vector<int> queries(tune_query_pool);
+    for (int& query : queries) {
+        query = keys(rng);
+    }
+
+    std::vector<layout> single;
+    int sink = tune_bplus<power, 8>(single, data, queries) +
+               tune_bplus<power, 16>(single, data, queries) +
+               tune_bplus<power, 32>(single, data, queries) +
+               tune_bplus<power, 64>(single, data, queries);
+    report_layouts(csv, power, single);
+
+    std::vector<layout> batched;
+    sink += tune_batch_sizes<power, 8>(batched, data, queries) +
+            tune_batch_sizes<power, 16>(batched, data, queries) +
+            tune_batch_sizes<power, 32>(batched, data, queries) +
+            tune_batch_sizes<power, 64>(batched, data, queries);
+    report_layouts(csv, power, batched);
 
     return sink;
 }
 
-int main() {
+template <size_t... powers>
+int tune_layouts(const char* path) {
+    std::ofstream csv(path);
+    if (!csv) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    csv << "name,size,width,batch,ns_per_query,chosen\n";
+    return (tune_layout<powers>(csv) + ...);
+}
+
+int main(int argc, char** argv) {
     setup_cpu_affinity();
 
+    if (argc > 1 && strcmp(argv[1], "latency") == 0) {
+        printf("Node search kernel: %s\n", isa::name(isa::active()));
+        printf("Result: %d\n", record_latencies<12, 16, 20, 24, 28>("results/latency.csv"));
+        return EXIT_SUCCESS;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "tune") == 0) {
+        printf("Node search kernel: %s\n", isa::name(isa::active()));
+        printf("Result: %d\n", tune_layouts<12, 16, 20, 24, 28>("results/layout.csv"));
+        return EXIT_SUCCESS;
+    }
+
     auto data = read_or_generate("data/data.bin", num_elements, true);
 
     int min_val = *std::min_element(data.begin(), data.end());
@@ -128,6 +425,7 @@ int main() {
     dist = std::uniform_int_distribution<int>(min_val, max_val);
 
     printf("Data prepared (%zu elements).\n", data.size());
+    printf("Node search kernel: %s\n", isa::name(isa::active()));
 
     printf("Result: %d\n", profile_batching_bplus(data));
     return EXIT_SUCCESS;
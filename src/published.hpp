@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+// Holds the current version of an index that is rebuilt in the background, so that lookups can
+// carry on while a new one is swapped in. Reclamation is quiescent state based (QSBR, the flavour
+// of RCU that asks nothing of a reader on each access):
+//
+// - a reader loads the current tree with a plain acquire load, and may keep using it until it next
+//   calls quiescent(), which stores the epoch it has seen into its own cache line;
+// - publish() swaps the pointer, advances the epoch and waits until every online reader has been
+//   quiescent since, after which none can still hold the old tree, and frees it.
+//
+// Neither get() nor quiescent() takes a lock or does an atomic read-modify-write. In exchange, a
+// reader that stops calling quiescent() holds up publish(), so one going idle should go offline().
+template <typename Tree>
+class published {
+private:
+    static constexpr uint64_t offline_epoch = std::numeric_limits<uint64_t>::max();
+
+    struct alignas(64) slot {
+        std::atomic<uint64_t> epoch{offline_epoch};
+        std::atomic<bool> taken{false};
+    };
+
+public:
+    explicit published(std::unique_ptr<Tree> initial, size_t max_readers = 64)
+        : _current(initial.release()),
+          _slots(std::make_unique<slot[]>(max_readers)),
+          _max_readers(max_readers) {}
+
+    // Every reader must be gone by now.
+    ~published() {
+        delete _current.load(std::memory_order_relaxed);
+    }
+
+    published(const published&) = delete;
+    published& operator=(const published&) = delete;
+
+    // One thread's handle on the index. It starts online.
+    class reader {
+    public:
+        explicit reader(published& index) : _index(index), _slot(index.claim()) {
+            online();
+        }
+
+        ~reader() {
+            offline();
+            _slot->taken.store(false, std::memory_order_release);
+        }
+
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+
+        // The current tree, valid until the next quiescent() or offline().
+        const Tree& get() const noexcept {
+            return *_index._current.load(std::memory_order_acquire);
+        }
+
+        // Declares that no tree from an earlier get() is still in use. Call it between batches.
+        void quiescent() noexcept {
+            uint64_t seen = _index._epoch.load(std::memory_order_acquire);
+            _slot->epoch.store(seen, std::memory_order_release);
+        }
+
+        // Stops holding up publish() until online(). get() may not be called in between.
+        void offline() noexcept {
+            _slot->epoch.store(offline_epoch, std::memory_order_release);
+        }
+
+        // The fence orders the store before any later get(): a publish() that has already looked
+        // at this slot and passed it must have swapped the pointer first.
+        void online() noexcept {
+            _slot->epoch.store(_index._epoch.load(std::memory_order_acquire),
+                               std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+    private:
+        published& _index;
+        slot* _slot;
+    };
+
+    // Makes next the tree readers get, then blocks until no reader can hold the previous one and
+    // frees it. The caller builds next on whichever thread it likes; publishers take turns.
+    void publish(std::unique_ptr<Tree> next) {
+        std::lock_guard lock(_publish_mutex);
+
+        Tree* previous = _current.exchange(next.release(), std::memory_order_seq_cst);
+        uint64_t epoch = _epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+        for (size_t i = 0; i < _max_readers; i++) {
+            while (_slots[i].epoch.load(std::memory_order_seq_cst) < epoch) {
+                std::this_thread::yield();
+            }
+        }
+
+        delete previous;
+    }
+
+    // The number of publish() calls so far.
+    uint64_t version() const noexcept {
+        return _epoch.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<Tree*> _current;
+    std::atomic<uint64_t> _epoch{0};
+    std::unique_ptr<slot[]> _slots;
+    size_t _max_readers;
+    std::mutex _publish_mutex;
+
+    slot* claim() {
+        for (size_t i = 0; i < _max_readers; i++) {
+            bool expected = false;
+            if (_slots[i].taken.compare_exchange_strong(expected, true)) {
+                return &_slots[i];
+            }
+        }
+        throw std::length_error("published: too many readers");
+    }
+};
@@ -1,11 +1,37 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
 
 #include "common.hpp"
+#include "latency_histogram.hpp"
+#include "layout.hpp"
+#include "parallel_lookup.hpp"
+#include "perf_counters.hpp"
+#include "published.hpp"
+#include "tree_arena.hpp"
+#include "trees/isa.hpp"
 #include "trees/batching_bplus.hpp"
 #include "trees/bplus.hpp"
 #include "trees/btree.hpp"
+#include "trees/compressed_bplus.hpp"
+#include "trees/delta_bplus.hpp"
+#include "trees/numa_bplus.hpp"
+#include "trees/prefix_bplus.hpp"
+#include "trees/runtime_bplus.hpp"
+#include "workload.hpp"
 
 class tree_test : public ::testing::Test {
 protected:
@@ -35,6 +61,42 @@ TEST_F(tree_test, btree) {
     }
 }
 
+// Sizes that leave the last level empty, partly filled, or with a single block.
+TEST(btree_batch, matches_lower_bound_across_heights) {
+    constexpr size_t batch_size = 16;
+
+    for (size_t size : {1, 16, 17, 18 * 16, 289 * 16 + 5, 10000, 100000}) {
+        std::vector<int> keys = generate_random_data(size);
+        std::sort(keys.begin(), keys.end());
+        std::vector<int> queries = generate_random_data(1024);
+        queries[0] = INT_MIN;
+        queries[1] = keys.front();
+        queries[2] = keys.back();
+
+        btree tree(keys);
+
+        for (size_t batch = 0; batch < queries.size(); batch += batch_size) {
+            int results[batch_size];
+            int speculated[batch_size];
+            tree.lower_bound_batch<batch_size>(&queries[batch], results);
+            tree.lower_bound_batch<batch_size, true>(&queries[batch], speculated);
+
+            for (size_t i = 0; i < batch_size; i++) {
+                auto expected = std::lower_bound(keys.begin(), keys.end(), queries[batch + i]);
+                int scalar = tree.lower_bound(queries[batch + i]);
+                EXPECT_EQ(results[i], scalar)
+                    << "size " << size << ", query value: " << queries[batch + i];
+                EXPECT_EQ(speculated[i], scalar)
+                    << "size " << size << ", query value: " << queries[batch + i];
+                if (expected != keys.end()) {
+                    EXPECT_EQ(results[i], *expected)
+                        << "size " << size << ", query value: " << queries[batch + i];
+                }
+            }
+        }
+    }
+}
+
 TEST_F(tree_test, bplus) {
     bplus<n> tree(data);
 
@@ -76,3 +138,1246 @@ TEST_F(tree_test, bplus_batch) {
         }
     }
 }
+
+TEST_F(tree_test, runtime_bplus) {
+    runtime_bplus<> tree(data);
+
+    for (size_t i = 0; i < n; i++) {
+        int tree_result = tree.lower_bound(queries[i]);
+        auto std_result = std::lower_bound(data.begin(), data.end(), queries[i]);
+
+        if (std_result != data.end()) {
+            EXPECT_EQ(tree_result, *std_result)
+                << "Mismatch at index " << i << ", query value: " << queries[i]
+                << ", tree returned: " << tree_result << ", expected: " << *std_result;
+        }
+    }
+}
+
+TEST_F(tree_test, runtime_bplus_batch) {
+    constexpr size_t batch_size = 16;
+    runtime_bplus<> tree(data);
+
+    for (size_t batch = 0; batch < n; batch += batch_size) {
+        int batch_queries[batch_size];
+        int batch_results[batch_size];
+
+        size_t current_batch_size = std::min(batch_size, n - batch);
+        for (size_t i = 0; i < current_batch_size; i++) {
+            batch_queries[i] = queries[batch + i];
+        }
+
+        tree.lower_bound_batch<batch_size>(batch_queries, batch_results);
+
+        for (size_t i = 0; i < current_batch_size; i++) {
+            auto result = std::lower_bound(data.begin(), data.end(), batch_queries[i]);
+            if (result != data.end()) {
+                EXPECT_EQ(batch_results[i], *result)
+                    << "Mismatch in batch " << batch / batch_size << " at index " << i
+                    << ", query value: " << batch_queries[i]
+                    << ", batch tree returned: " << batch_results[i] << ", expected: " << *result;
+            }
+        }
+    }
+}
+
+TEST(runtime_bplus_sizes, matches_lower_bound_across_heights) {
+    for (size_t size : {0, 1, 15, 16, 17, 272, 273, 4641, 100000}) {
+        auto keys = generate_random_data(size);
+        std::sort(keys.begin(), keys.end());
+        runtime_bplus<> tree(keys);
+
+        for (int query : generate_random_data(1000)) {
+            auto result = std::lower_bound(keys.begin(), keys.end(), query);
+            if (result != keys.end()) {
+                EXPECT_EQ(tree.lower_bound(query), *result)
+                    << "Mismatch for size " << size << ", height " << tree.height()
+                    << ", query value: " << query;
+            }
+        }
+    }
+}
+
+TEST_F(tree_test, bplus_batch_rank) {
+    constexpr size_t batch_size = 16;
+    batching_bplus<n, batch_size> tree(data);
+
+    for (size_t batch = 0; batch + batch_size <= n; batch += batch_size) {
+        size_t batch_ranks[batch_size];
+        tree.lower_bound_rank_batch(&queries[batch], batch_ranks);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            size_t expected =
+                std::lower_bound(data.begin(), data.end(), queries[batch + i]) - data.begin();
+            EXPECT_EQ(batch_ranks[i], expected)
+                << "Mismatch in batch " << batch / batch_size << " at index " << i
+                << ", query value: " << queries[batch + i];
+        }
+    }
+}
+
+TEST_F(tree_test, runtime_bplus_batch_rank) {
+    constexpr size_t batch_size = 16;
+    runtime_bplus<> tree(data);
+
+    for (size_t batch = 0; batch + batch_size <= n; batch += batch_size) {
+        size_t batch_ranks[batch_size];
+        tree.lower_bound_rank_batch<batch_size>(&queries[batch], batch_ranks);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            size_t expected =
+                std::lower_bound(data.begin(), data.end(), queries[batch + i]) - data.begin();
+            EXPECT_EQ(batch_ranks[i], expected)
+                << "Mismatch in batch " << batch / batch_size << " at index " << i
+                << ", query value: " << queries[batch + i];
+        }
+    }
+
+    // Past the last key, the rank is the number of keys.
+    int past_end[batch_size];
+    std::fill_n(past_end, batch_size, data.back() + 1);
+    size_t past_end_ranks[batch_size];
+    tree.lower_bound_rank_batch<batch_size>(past_end, past_end_ranks);
+    for (size_t i = 0; i < batch_size; i++) {
+        EXPECT_EQ(past_end_ranks[i], n);
+    }
+}
+
+TEST_F(tree_test, runtime_bplus_batch_value) {
+    constexpr size_t batch_size = 16;
+
+    std::vector<uint64_t> row_ids(n);
+    for (size_t i = 0; i < n; i++) {
+        row_ids[i] = (uint64_t{1} << 40) + i;
+    }
+    runtime_bplus<int, uint64_t> tree(data, row_ids);
+
+    for (size_t batch = 0; batch + batch_size <= n; batch += batch_size) {
+        uint64_t batch_values[batch_size];
+        tree.lower_bound_value_batch<batch_size>(&queries[batch], batch_values);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            auto result = std::lower_bound(data.begin(), data.end(), queries[batch + i]);
+            uint64_t expected = (result != data.end()) ? row_ids[result - data.begin()] : 0;
+            EXPECT_EQ(batch_values[i], expected)
+                << "Mismatch in batch " << batch / batch_size << " at index " << i
+                << ", query value: " << queries[batch + i];
+        }
+    }
+
+    row_ids.pop_back();
+    using with_payload = runtime_bplus<int, uint64_t>;
+    EXPECT_THROW(with_payload(data, row_ids), std::invalid_argument);
+}
+
+template <typename T>
+class typed_tree_test : public ::testing::Test {
+protected:
+    static constexpr size_t n = 10000;
+    std::vector<T> data;
+    std::vector<T> queries;
+
+    void SetUp() override {
+        queries = generate_random_data<T>(n);
+        data = generate_random_data<T>(n);
+        std::sort(data.begin(), data.end());
+    }
+};
+
+using key_types = ::testing::Types<int32_t, uint32_t, int64_t, uint64_t, float, double>;
+TYPED_TEST_SUITE(typed_tree_test, key_types);
+
+TYPED_TEST(typed_tree_test, bplus) {
+    constexpr size_t size = TestFixture::n;
+    const auto& keys = this->data;
+    const auto& probes = this->queries;
+
+    bplus<size, TypeParam> tree(keys);
+
+    for (size_t i = 0; i < size; i++) {
+        TypeParam tree_result = tree.lower_bound(probes[i]);
+        auto std_result = std::lower_bound(keys.begin(), keys.end(), probes[i]);
+
+        if (std_result != keys.end()) {
+            EXPECT_EQ(tree_result, *std_result)
+                << "Mismatch at index " << i << ", query value: " << probes[i];
+        }
+    }
+}
+
+TYPED_TEST(typed_tree_test, bplus_batch_rank) {
+    constexpr size_t size = TestFixture::n;
+    constexpr size_t batch_size = 16;
+    const auto& keys = this->data;
+    const auto& probes = this->queries;
+
+    batching_bplus<size, batch_size, TypeParam> tree(keys);
+
+    for (size_t batch = 0; batch + batch_size <= size; batch += batch_size) {
+        size_t batch_ranks[batch_size];
+        tree.lower_bound_rank_batch(&probes[batch], batch_ranks);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            size_t expected =
+                std::lower_bound(keys.begin(), keys.end(), probes[batch + i]) - keys.begin();
+            EXPECT_EQ(batch_ranks[i], expected)
+                << "Mismatch in batch " << batch / batch_size << " at index " << i
+                << ", query value: " << probes[batch + i];
+        }
+    }
+}
+
+// Nodes of half a cache line to eight lines, for 32- and 64-bit keys alike, with every kernel.
+TYPED_TEST(typed_tree_test, bplus_node_widths) {
+    constexpr size_t size = TestFixture::n;
+    constexpr size_t batch_size = 16;
+    const auto& keys = this->data;
+    const auto& probes = this->queries;
+
+    auto check = [&]<int Width>() {
+        bplus<size, TypeParam, Width> tree(keys);
+        batching_bplus<size, batch_size, TypeParam, Width> batching_tree(keys);
+
+        for (isa::level kernel : {isa::level::scalar, isa::level::avx2, isa::level::avx512}) {
+            if (!isa::select(kernel)) {
+                continue;
+            }
+
+            for (size_t batch = 0; batch + batch_size <= size; batch += batch_size) {
+                size_t batch_ranks[batch_size];
+                batching_tree.lower_bound_rank_batch(&probes[batch], batch_ranks);
+
+                for (size_t i = 0; i < batch_size; i++) {
+                    auto result = std::lower_bound(keys.begin(), keys.end(), probes[batch + i]);
+                    size_t expected = result - keys.begin();
+                    EXPECT_EQ(tree.lower_bound_rank(probes[batch + i]), expected)
+                        << "Width " << Width << " with kernel " << isa::name(kernel)
+                        << ", query value: " << probes[batch + i];
+                    EXPECT_EQ(batch_ranks[i], expected)
+                        << "Width " << Width << " with kernel " << isa::name(kernel)
+                        << ", query value: " << probes[batch + i];
+                }
+            }
+        }
+
+        isa::select(isa::supported);
+    };
+
+    if constexpr (node<TypeParam>::block_len == 8) {
+        check.template operator()<4>();
+    }
+    check.template operator()<8>();
+    check.template operator()<16>();
+    check.template operator()<32>();
+    check.template operator()<64>();
+}
+
+TYPED_TEST(typed_tree_test, runtime_bplus_batch) {
+    constexpr size_t size = TestFixture::n;
+    constexpr size_t batch_size = 16;
+    const auto& keys = this->data;
+    const auto& probes = this->queries;
+
+    runtime_bplus<TypeParam> tree(keys);
+
+    for (size_t batch = 0; batch + batch_size <= size; batch += batch_size) {
+        TypeParam batch_results[batch_size];
+        size_t batch_ranks[batch_size];
+        tree.template lower_bound_batch<batch_size>(&probes[batch], batch_results);
+        tree.template lower_bound_rank_batch<batch_size>(&probes[batch], batch_ranks);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            auto result = std::lower_bound(keys.begin(), keys.end(), probes[batch + i]);
+            EXPECT_EQ(batch_ranks[i], static_cast<size_t>(result - keys.begin()))
+                << "Mismatch in batch " << batch / batch_size << " at index " << i
+                << ", query value: " << probes[batch + i];
+            if (result != keys.end()) {
+                EXPECT_EQ(batch_results[i], *result)
+                    << "Mismatch in batch " << batch / batch_size << " at index " << i
+                    << ", query value: " << probes[batch + i];
+            }
+        }
+    }
+}
+
+TEST(runtime_bplus_float, orders_like_lower_bound) {
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    constexpr float nan = std::numeric_limits<float>::quiet_NaN();
+
+    std::vector<float> keys = {-inf, -1e30f, -2.5f, -0.0f, 0.0f, 1e-30f, 3.0f, 3.0f, 1e30f, inf};
+    runtime_bplus<float> tree(keys);
+
+    constexpr size_t batch_size = 8;
+    float batch_queries[batch_size] = {nan, -inf, -3.0f, 0.0f, -0.0f, 3.0f, 2e30f, inf};
+    size_t batch_ranks[batch_size];
+    tree.lower_bound_rank_batch<batch_size>(batch_queries, batch_ranks);
+
+    for (size_t i = 0; i < batch_size; i++) {
+        size_t expected =
+            std::lower_bound(keys.begin(), keys.end(), batch_queries[i]) - keys.begin();
+        EXPECT_EQ(batch_ranks[i], expected) << "Mismatch for query value: " << batch_queries[i];
+    }
+}
+
+// Every kernel the host supports must agree with std::lower_bound, not just the one picked by
+// default.
+TYPED_TEST(typed_tree_test, kernels) {
+    constexpr size_t size = TestFixture::n;
+    constexpr size_t batch_size = 16;
+    const auto& keys = this->data;
+    const auto& probes = this->queries;
+
+    runtime_bplus<TypeParam> tree(keys);
+
+    for (isa::level kernel : {isa::level::scalar, isa::level::avx2, isa::level::avx512}) {
+        if (!isa::select(kernel)) {
+            continue;
+        }
+
+        for (size_t batch = 0; batch + batch_size <= size; batch += batch_size) {
+            size_t batch_ranks[batch_size];
+            tree.template lower_bound_rank_batch<batch_size>(&probes[batch], batch_ranks);
+
+            for (size_t i = 0; i < batch_size; i++) {
+                size_t expected =
+                    std::lower_bound(keys.begin(), keys.end(), probes[batch + i]) - keys.begin();
+                EXPECT_EQ(batch_ranks[i], expected)
+                    << "Mismatch with kernel " << isa::name(kernel) << " at index " << batch + i
+                    << ", query value: " << probes[batch + i];
+            }
+        }
+    }
+
+    isa::select(isa::supported);
+}
+
+TEST_F(tree_test, btree_kernels) {
+    btree tree(data);
+
+    for (isa::level kernel : {isa::level::scalar, isa::level::avx2, isa::level::avx512}) {
+        if (!isa::select(kernel)) {
+            continue;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            int tree_result = tree.lower_bound(queries[i]);
+            auto std_result = std::lower_bound(data.begin(), data.end(), queries[i]);
+
+            if (std_result != data.end()) {
+                EXPECT_EQ(tree_result, *std_result)
+                    << "Mismatch with kernel " << isa::name(kernel) << " at index " << i
+                    << ", query value: " << queries[i];
+            }
+        }
+    }
+
+    isa::select(isa::supported);
+}
+
+TEST_F(tree_test, runtime_bplus_parallel) {
+    runtime_bplus<> tree(data);
+
+    // n is not a multiple of the batch size, so the last batch is a partial one.
+    for (size_t threads : {1, 2, 5}) {
+        thread_pool pool(threads);
+
+        std::vector<size_t> ranks(n);
+        lower_bound_rank_parallel<64>(pool, tree, queries, ranks);
+
+        std::vector<int> results(n);
+        lower_bound_parallel<64>(pool, tree, queries, results);
+
+        for (size_t i = 0; i < n; i++) {
+            auto result = std::lower_bound(data.begin(), data.end(), queries[i]);
+            EXPECT_EQ(ranks[i], static_cast<size_t>(result - data.begin()))
+                << "Mismatch with " << threads << " threads at index " << i
+                << ", query value: " << queries[i];
+            if (result != data.end()) {
+                EXPECT_EQ(results[i], *result)
+                    << "Mismatch with " << threads << " threads at index " << i
+                    << ", query value: " << queries[i];
+            }
+        }
+    }
+}
+
+// With an empty delta, targets past the last key must still give max_key, including when the
+// leaves fill their last node exactly and are followed directly by the next layer.
+TEST(delta_bplus, max_key_past_the_end_with_empty_delta) {
+    for (size_t size : {16, 32, 256, 4096, 4097}) {
+        std::vector<int> data(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = static_cast<int>(i * 10);
+        }
+
+        delta_bplus<> tree(data);
+        ASSERT_EQ(tree.delta_size(), 0u);
+
+        constexpr size_t batch_size = 16;
+        int batch_queries[batch_size];
+        int batch_results[batch_size];
+        for (size_t i = 0; i < batch_size; i++) {
+            batch_queries[i] = data.back() + 1 + static_cast<int>(i) * 1000;
+        }
+        tree.lower_bound_batch<batch_size>(batch_queries, batch_results);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            EXPECT_EQ(tree.lower_bound(batch_queries[i]), node<int>::max_key)
+                << "size " << size << ", query value: " << batch_queries[i];
+            EXPECT_EQ(batch_results[i], node<int>::max_key)
+                << "size " << size << ", query value: " << batch_queries[i];
+        }
+        EXPECT_EQ(tree.lower_bound(data.back()), data.back());
+    }
+}
+
+TEST(delta_bplus, matches_set_under_updates) {
+    // A narrow key range, so that inserts and erases often hit existing keys and each other.
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> dist(0, 20000);
+
+    std::vector<int> data(5000);
+    for (int& key : data) {
+        key = dist(rng);
+    }
+    std::sort(data.begin(), data.end());
+
+    // Merging in the background every 512 writes, and never, so the delta spans many chunks.
+    for (size_t threshold : {size_t{512}, SIZE_MAX}) {
+        delta_bplus<> tree(data, threshold);
+        std::set<int> model(data.begin(), data.end());
+        bool merged = false;
+
+        auto check = [&](int round) {
+            constexpr size_t batch_size = 16;
+            int batch_queries[batch_size];
+            int batch_results[batch_size];
+            for (size_t i = 0; i < batch_size; i++) {
+                batch_queries[i] = dist(rng);
+            }
+            tree.lower_bound_batch<batch_size>(batch_queries, batch_results);
+
+            for (size_t i = 0; i < batch_size; i++) {
+                auto result = model.lower_bound(batch_queries[i]);
+                int expected = result == model.end() ? node<int>::max_key : *result;
+                EXPECT_EQ(tree.lower_bound(batch_queries[i]), expected)
+                    << "Mismatch in round " << round << ", query value: " << batch_queries[i];
+                EXPECT_EQ(batch_results[i], expected) << "Batch mismatch in round " << round
+                                                      << ", query value: " << batch_queries[i];
+            }
+        };
+
+        for (int round = 0; round < 5000; round++) {
+            int key = dist(rng);
+            if (rng() % 2) {
+                tree.insert(key);
+                model.insert(key);
+            } else {
+                tree.erase(key);
+                model.erase(key);
+            }
+            merged |= tree.merging();
+            check(round);
+        }
+        EXPECT_EQ(merged, threshold != SIZE_MAX);
+
+        tree.merge();
+        EXPECT_FALSE(tree.merging());
+        EXPECT_EQ(tree.delta_size(), 0u);
+        EXPECT_EQ(tree.base().keys(), model.size());
+        check(-1);
+    }
+}
+
+TEST_F(tree_test, bplus_range) {
+    bplus<n> tree(data);
+    runtime_bplus<> runtime_tree(data);
+
+    // Consecutive queries as bounds, so roughly half the ranges are empty with hi < lo.
+    for (size_t i = 0; i + 1 < n; i++) {
+        int lo = queries[i];
+        int hi = queries[i + 1];
+
+        auto first = std::lower_bound(data.begin(), data.end(), lo);
+        auto last = std::max(first, std::lower_bound(data.begin(), data.end(), hi));
+        size_t expected = last - first;
+
+        EXPECT_EQ(tree.count(lo, hi), expected) << "Mismatch for range " << lo << ", " << hi;
+        EXPECT_EQ(runtime_tree.count(lo, hi), expected)
+            << "Runtime mismatch for range " << lo << ", " << hi;
+
+        std::span<const int> range = tree.range(lo, hi);
+        ASSERT_EQ(range.size(), expected);
+        EXPECT_TRUE(std::equal(range.begin(), range.end(), first))
+            << "Wrong keys for range " << lo << ", " << hi;
+        EXPECT_EQ(tree.lower_bound_rank(lo), static_cast<size_t>(first - data.begin()));
+    }
+}
+
+TEST_F(tree_test, range_batch) {
+    constexpr size_t batch_size = 16;
+    batching_bplus<n, batch_size> tree(data);
+    runtime_bplus<> runtime_tree(data);
+
+    for (size_t batch = 0; batch + 2 * batch_size <= n; batch += 2 * batch_size) {
+        const int* los = &queries[batch];
+        const int* his = &queries[batch + batch_size];
+
+        size_t counts[batch_size];
+        size_t runtime_counts[batch_size];
+        std::span<const int> ranges[batch_size];
+        std::span<const int> runtime_ranges[batch_size];
+        tree.count_batch(los, his, counts);
+        tree.range_batch(los, his, ranges);
+        runtime_tree.count_batch<batch_size>(los, his, runtime_counts);
+        runtime_tree.range_batch<batch_size>(los, his, runtime_ranges);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            auto first = std::lower_bound(data.begin(), data.end(), los[i]);
+            auto last = std::max(first, std::lower_bound(data.begin(), data.end(), his[i]));
+            size_t expected = last - first;
+
+            EXPECT_EQ(counts[i], expected) << "Mismatch for range " << los[i] << ", " << his[i];
+            EXPECT_EQ(runtime_counts[i], expected)
+                << "Runtime mismatch for range " << los[i] << ", " << his[i];
+            EXPECT_TRUE(std::equal(ranges[i].begin(), ranges[i].end(), first, last));
+            EXPECT_EQ(runtime_ranges[i].data(),
+                      runtime_tree.leaves().data() + (first - data.begin()));
+            EXPECT_EQ(runtime_ranges[i].size(), expected);
+        }
+    }
+}
+
+TEST_F(tree_test, runtime_bplus_save_open) {
+    std::string path = (std::filesystem::temp_directory_path() / "runtime_bplus_test.bin").string();
+
+    std::vector<uint64_t> row_ids(n);
+    for (size_t i = 0; i < n; i++) {
+        row_ids[i] = i;
+    }
+    runtime_bplus<int, uint64_t>(data, row_ids).save(path.c_str());
+
+    for (bool populate : {false, true}) {
+        auto tree = runtime_bplus<int, uint64_t>::open(path.c_str(), {.populate = populate});
+        ASSERT_EQ(tree.keys(), n);
+
+        constexpr size_t batch_size = 16;
+        for (size_t batch = 0; batch + batch_size <= n; batch += batch_size) {
+            uint64_t batch_values[batch_size];
+            tree.lower_bound_value_batch<batch_size>(&queries[batch], batch_values);
+
+            for (size_t i = 0; i < batch_size; i++) {
+                int query = queries[batch + i];
+                auto result = std::lower_bound(data.begin(), data.end(), query);
+                size_t rank = result - data.begin();
+
+                EXPECT_EQ(tree.lower_bound_rank(query), rank) << "query value: " << query;
+                EXPECT_EQ(batch_values[i], rank < n ? row_ids[rank] : 0)
+                    << "query value: " << query;
+                if (result != data.end()) {
+                    EXPECT_EQ(tree.lower_bound(query), *result) << "query value: " << query;
+                }
+            }
+        }
+    }
+
+    // Keys only, ignoring the payload.
+    auto keys_only = runtime_bplus<>::open(path.c_str());
+    EXPECT_EQ(keys_only.lower_bound(data[n / 2]), data[n / 2]);
+
+    EXPECT_THROW(runtime_bplus<float>::open(path.c_str()), std::runtime_error);
+    using narrow_payload = runtime_bplus<int, uint32_t>;
+    EXPECT_THROW(narrow_payload::open(path.c_str()), std::runtime_error);
+
+    // A payload is required if V asks for one, or lookups would read values that aren't there.
+    runtime_bplus<>(data).save(path.c_str());
+    using with_payload = runtime_bplus<int, uint64_t>;
+    EXPECT_THROW(with_payload::open(path.c_str()), std::runtime_error);
+
+    // Files that aren't trees are rejected before their header is used to size anything: one of
+    // garbage, and a tree whose header claims more keys than the file holds.
+    std::ofstream(path, std::ios::binary) << std::string(8192, '\xff');
+    EXPECT_THROW(runtime_bplus<>::open(path.c_str()), std::runtime_error);
+
+    runtime_bplus<>(data).save(path.c_str());
+    uint64_t claimed = uint64_t{1} << 62;
+    std::fstream(path, std::ios::binary | std::ios::in | std::ios::out)
+        .seekp(24)
+        .write(reinterpret_cast<const char*>(&claimed), sizeof(claimed));
+    EXPECT_THROW(runtime_bplus<>::open(path.c_str()), std::runtime_error);
+
+    std::filesystem::remove(path);
+    EXPECT_THROW(runtime_bplus<>::open(path.c_str()), std::system_error);
+}
+
+TEST(runtime_bplus_build, parallel_and_streaming_match_serial) {
+    // Several parallel chunks per layer, and a partial last chunk when streaming.
+    constexpr size_t size = 1'000'003;
+    auto keys = generate_random_data(size);
+    std::sort(keys.begin(), keys.end());
+    auto probes = generate_random_data(10000);
+
+    thread_pool pool(3);
+    runtime_bplus<> parallel(keys, pool);
+
+    size_t streamed = 0;
+    runtime_bplus<> streaming(size, [&](std::span<int> chunk) {
+        std::copy_n(keys.begin() + streamed, chunk.size(), chunk.begin());
+        streamed += chunk.size();
+    });
+    EXPECT_EQ(streamed, size);
+
+    std::string path = (std::filesystem::temp_directory_path() / "runtime_bplus_keys.bin").string();
+    std::ofstream(path, std::ios::binary)
+        .write(reinterpret_cast<const char*>(keys.data()), size * sizeof(int));
+    auto from_file = runtime_bplus<>::from_file(path.c_str());
+
+    // A trailing byte that is not a whole key.
+    std::ofstream(path, std::ios::binary | std::ios::app).put('\0');
+    EXPECT_THROW(runtime_bplus<>::from_file(path.c_str()), std::runtime_error);
+    std::filesystem::remove(path);
+
+    for (const runtime_bplus<>* tree : {&parallel, &streaming, &from_file}) {
+        ASSERT_EQ(tree->keys(), size);
+        for (int probe : probes) {
+            auto result = std::lower_bound(keys.begin(), keys.end(), probe);
+            EXPECT_EQ(tree->lower_bound_rank(probe), static_cast<size_t>(result - keys.begin()))
+                << "query value: " << probe;
+        }
+    }
+}
+
+TEST(perf_counters, counts_or_reports_unavailable) {
+    perf_counters counters;
+    if (!counters.available()) {
+        GTEST_SKIP() << "perf_event_open is not available on this host";
+    }
+
+    volatile int sink = 0;
+    {
+        perf_counters::scope counting(counters);
+        for (int i = 0; i < 1000000; i++) {
+            sink = sink + i;
+        }
+    }
+
+    auto instructions = counters[perf_counters::instructions];
+    ASSERT_TRUE(instructions.has_value());
+    EXPECT_GT(*instructions, 1000000);
+}
+
+TEST(latency_histogram, percentiles_within_bucket_error) {
+    latency_histogram hist;
+    EXPECT_EQ(hist.percentile(0.5), 0u);
+
+    // Small values are exact, larger ones within one 1/32 sub-bucket, and counts weight them.
+    for (uint64_t ticks = 1; ticks <= 100000; ticks++) {
+        hist.record(ticks);
+    }
+    hist.record(1000000000, 100000);
+    EXPECT_EQ(hist.count(), 200000u);
+
+    EXPECT_EQ(hist.percentile(0), 1u);
+    EXPECT_NEAR(static_cast<double>(hist.percentile(0.25)), 50000, 50000 / 32.0);
+    EXPECT_NEAR(static_cast<double>(hist.percentile(0.5)), 100000, 100000 / 32.0);
+    EXPECT_NEAR(static_cast<double>(hist.percentile(0.99)), 1e9, 1e9 / 32);
+    EXPECT_GE(hist.percentile(1), 1000000000u);
+}
+
+TEST(workload, generates_expected_streams) {
+    auto keys = generate_random_data(100000);
+    std::sort(keys.begin(), keys.end());
+    constexpr size_t count = 100000;
+
+    auto sorted = generate_queries<int>(workload::sorted, keys, count);
+    EXPECT_TRUE(std::is_sorted(sorted.begin(), sorted.end()));
+
+    workload_options options;
+    options.hot_keys = 100;
+    auto hot = generate_queries<int>(workload::hot_set, keys, count, options);
+    EXPECT_LE(std::set<int>(hot.begin(), hot.end()).size(), options.hot_keys);
+
+    // With s = 0.99 over 100000 keys, the most popular key draws about 8% of queries.
+    auto zipf = generate_queries<int>(workload::zipf, keys, count);
+    std::map<int, size_t> frequency;
+    for (int query : zipf) {
+        EXPECT_TRUE(std::binary_search(keys.begin(), keys.end(), query));
+        frequency[query]++;
+    }
+    size_t top = 0;
+    for (auto [key, seen] : frequency) {
+        top = std::max(top, seen);
+    }
+    EXPECT_GT(top, count / 20);
+    EXPECT_LT(top, count / 8);
+
+    options.replay_path = (std::filesystem::temp_directory_path() / "workload_test.bin").string();
+    std::ofstream(options.replay_path, std::ios::binary)
+        .write(reinterpret_cast<const char*>(sorted.data()), 1000 * sizeof(int));
+    auto replayed = generate_queries<int>(workload::replay, keys, 2500, options);
+    std::filesystem::remove(options.replay_path);
+    for (size_t i = 0; i < replayed.size(); i++) {
+        EXPECT_EQ(replayed[i], sorted[i % 1000]);
+    }
+
+    for (workload w : {workload::uniform, workload::zipf, workload::sorted, workload::hot_set}) {
+        EXPECT_THROW(generate_queries<int>(w, {}, count), std::invalid_argument) << name(w);
+    }
+}
+
+TEST(layout, reads_back_the_chosen_layouts) {
+    std::string path = (std::filesystem::temp_directory_path() / "layout_test.csv").string();
+    std::ofstream(path) << "name,size,width,batch,ns_per_query,chosen\n"
+                        << "bplus,16,16,1,8.9,0\n"
+                        << "bplus,16,32,1,8.6,1\n"
+                        << "batching_bplus,16,16,64,5.9,0\n"
+                        << "batching_bplus,16,32,64,5.7,1\n";
+
+    auto single = read_tuned_layout(path, "bplus", 16);
+    ASSERT_TRUE(single.has_value());
+    EXPECT_EQ(single->width, 32);
+    EXPECT_EQ(single->batch, 1u);
+
+    auto batched = read_tuned_layout(path, "batching_bplus", 16);
+    ASSERT_TRUE(batched.has_value());
+    EXPECT_EQ(batched->width, 32);
+    EXPECT_EQ(batched->batch, 64u);
+
+    EXPECT_FALSE(read_tuned_layout(path, "bplus", 20).has_value());
+    std::filesystem::remove(path);
+    EXPECT_FALSE(read_tuned_layout(path, "bplus", 16).has_value());
+}
+
+TEST_F(tree_test, runtime_bplus_stream) {
+    runtime_bplus<> tree(data);
+
+    auto check = [&](const std::vector<int>& results, size_t in_flight) {
+        for (size_t i = 0; i < n; i++) {
+            auto result = std::lower_bound(data.begin(), data.end(), queries[i]);
+            if (result != data.end()) {
+                EXPECT_EQ(results[i], *result)
+                    << "Mismatch with " << in_flight << " in flight at index " << i
+                    << ", query value: " << queries[i];
+            }
+        }
+    };
+
+    std::vector<int> results(n);
+    tree.lower_bound_stream<1>(queries, results);
+    check(results, 1);
+    tree.lower_bound_stream<13>(queries, results);
+    check(results, 13);
+
+    // Fewer queries than slots.
+    std::vector<int> few(queries.begin(), queries.begin() + 5);
+    std::vector<int> few_results(few.size());
+    tree.lower_bound_stream<32>(few, few_results);
+    for (size_t i = 0; i < few.size(); i++) {
+        EXPECT_EQ(few_results[i], tree.lower_bound(few[i]));
+    }
+}
+
+TYPED_TEST(typed_tree_test, runtime_bplus_vertical) {
+    if constexpr (sizeof(TypeParam) == 4) {
+        constexpr size_t size = TestFixture::n;
+        const auto& keys = this->data;
+        const auto& probes = this->queries;
+
+        // Enough keys that the hybrid has both vertical and per query layers.
+        std::vector<TypeParam> large_keys = generate_random_data<TypeParam>(1 << 20);
+        std::sort(large_keys.begin(), large_keys.end());
+
+        runtime_bplus<TypeParam> small_tree(keys);
+        runtime_bplus<TypeParam> large_tree(large_keys);
+
+        auto check = [&]<size_t B>(const runtime_bplus<TypeParam>& tree,
+                                   const std::vector<TypeParam>& sorted) {
+            for (size_t batch = 0; batch + B <= size; batch += B) {
+                TypeParam vertical[B];
+                TypeParam hybrid[B];
+                tree.template lower_bound_batch_vertical<B>(&probes[batch], vertical);
+                tree.template lower_bound_batch_hybrid<B>(&probes[batch], hybrid);
+
+                for (size_t i = 0; i < B; i++) {
+                    auto result = std::lower_bound(sorted.begin(), sorted.end(), probes[batch + i]);
+                    if (result != sorted.end()) {
+                        EXPECT_EQ(vertical[i], *result)
+                            << "Vertical mismatch with B = " << B
+                            << ", query value: " << probes[batch + i];
+                        EXPECT_EQ(hybrid[i], *result)
+                            << "Hybrid mismatch with B = " << B
+                            << ", query value: " << probes[batch + i];
+                    }
+                }
+            }
+        };
+
+        for (const auto* tree : {&small_tree, &large_tree}) {
+            const auto& sorted = tree == &small_tree ? keys : large_keys;
+            check.template operator()<16>(*tree, sorted);
+            check.template operator()<32>(*tree, sorted);
+            check.template operator()<64>(*tree, sorted);
+        }
+    }
+}
+
+TEST_F(tree_test, numa_bplus) {
+    constexpr size_t batch_size = 16;
+    numa_bplus<> replicated(data, numa_bplus<>::replicate);
+    numa_bplus<> interleaved(data, numa_bplus<>::interleave);
+    EXPECT_EQ(replicated.replicas(), static_cast<size_t>(numa::node_count()));
+    EXPECT_EQ(interleaved.replicas(), 1u);
+
+    // A copied replica, placed on a node, answers like the tree it was copied from.
+    runtime_bplus<> copy(replicated.replica(0), numa::placement::on(0));
+
+    for (size_t batch = 0; batch + batch_size <= n; batch += batch_size) {
+        int replicated_results[batch_size];
+        int interleaved_results[batch_size];
+        replicated.lower_bound_batch<batch_size>(&queries[batch], replicated_results);
+        interleaved.lower_bound_batch<batch_size>(&queries[batch], interleaved_results);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            int query = queries[batch + i];
+            auto result = std::lower_bound(data.begin(), data.end(), query);
+            if (result != data.end()) {
+                EXPECT_EQ(replicated_results[i], *result) << "query value: " << query;
+                EXPECT_EQ(interleaved_results[i], *result) << "query value: " << query;
+                EXPECT_EQ(copy.lower_bound(query), *result) << "query value: " << query;
+            }
+        }
+    }
+}
+
+TEST(compressed_bplus, matches_lower_bound_with_packed_and_raw_leaves) {
+    constexpr size_t batch_size = 16;
+
+    // Sparse keys never pack, clustered keys nearly always do, and 2^20 uniform keys are a mix.
+    // Runs of duplicates and the edges of the int range are included too.
+    std::vector<std::vector<int>> inputs = {
+        {}, {7}, generate_clustered_data(17), generate_clustered_data(100000),
+        generate_random_data(1 << 20), generate_random_data(5000),
+    };
+    std::vector<int> edges;
+    for (int i = 0; i < 100000; i++) {
+        edges.push_back(i / 3 + INT_MIN);
+        edges.push_back(INT_MAX - i / 3);
+    }
+    inputs.push_back(edges);
+
+    for (auto& keys : inputs) {
+        std::sort(keys.begin(), keys.end());
+        compressed_bplus tree(keys);
+        EXPECT_EQ(tree.keys(), keys.size());
+
+        std::vector<int> probes = generate_random_data(10000);
+        for (size_t i = 0; i < keys.size(); i += 97) {
+            probes.push_back(keys[i]);
+            probes.push_back(keys[i] + 1);
+        }
+        probes.push_back(INT_MIN);
+        probes.push_back(INT_MAX);
+        probes.resize(probes.size() / batch_size * batch_size);
+
+        for (isa::level kernel : {isa::level::scalar, isa::level::avx2, isa::level::avx512}) {
+            if (!isa::select(kernel)) {
+                continue;
+            }
+
+            for (size_t batch = 0; batch < probes.size(); batch += batch_size) {
+                int results[batch_size];
+                tree.lower_bound_batch<batch_size>(&probes[batch], results);
+
+                for (size_t i = 0; i < batch_size; i++) {
+                    int probe = probes[batch + i];
+                    auto result = std::lower_bound(keys.begin(), keys.end(), probe);
+                    int expected = result != keys.end() ? *result : node<int>::max_key;
+                    EXPECT_EQ(tree.lower_bound(probe), expected)
+                        << "Mismatch with kernel " << isa::name(kernel) << " for size "
+                        << keys.size() << ", query value: " << probe;
+                    EXPECT_EQ(results[i], expected)
+                        << "Batch mismatch with kernel " << isa::name(kernel) << " for size "
+                        << keys.size() << ", query value: " << probe;
+                }
+            }
+        }
+        isa::select(isa::supported);
+    }
+
+    compressed_bplus clustered(inputs[3]);
+    EXPECT_GT(clustered.packed_blocks(), clustered.leaf_blocks() * 9 / 10);
+    compressed_bplus sparse(inputs[5]);
+    EXPECT_EQ(sparse.packed_blocks(), 0u);
+}
+
+TEST(runtime_bplus_radix, matches_lower_bound_for_even_and_skewed_keys) {
+    // Spread evenly, in dense runs, bunched towards zero, and with a single outlier.
+    auto uniform = generate_random_data(1 << 18);
+    auto clustered = generate_clustered_data(1 << 18);
+    auto skewed = generate_skewed_data(1 << 18);
+    std::vector<int> outlier(1000);
+    std::iota(outlier.begin(), outlier.end(), INT_MIN);
+    outlier.push_back(INT_MAX);
+
+    for (auto* keys : {&uniform, &clustered, &skewed, &outlier}) {
+        std::sort(keys->begin(), keys->end());
+        runtime_bplus<> tree(*keys);
+
+        auto probes = generate_random_data(10000);
+        for (size_t i = 0; i < keys->size(); i += 101) {
+            probes.push_back((*keys)[i]);
+        }
+        probes.push_back(INT_MIN);
+
+        for (int bits : {1, 8, 16, 20}) {
+            tree.build_radix_root(bits);
+
+            for (int probe : probes) {
+                auto result = std::lower_bound(keys->begin(), keys->end(), probe);
+                if (result != keys->end()) {
+                    EXPECT_EQ(tree.lower_bound_radix(probe), *result)
+                        << "Mismatch with " << bits << " bits, query value: " << probe;
+                }
+            }
+        }
+    }
+
+    auto wide = generate_random_data<uint64_t>(100000);
+    std::sort(wide.begin(), wide.end());
+    runtime_bplus<uint64_t> wide_tree(wide);
+    wide_tree.build_radix_root();
+    for (uint64_t probe : generate_random_data<uint64_t>(10000)) {
+        auto result = std::lower_bound(wide.begin(), wide.end(), probe);
+        if (result != wide.end()) {
+            EXPECT_EQ(wide_tree.lower_bound_radix(probe), *result) << "query value: " << probe;
+        }
+    }
+}
+
+TEST_F(tree_test, runtime_bplus_inner_layers) {
+    constexpr size_t batch_size = 16;
+    runtime_bplus<> tree(data);
+    EXPECT_EQ(tree.inner_page_bytes(), 0u);
+
+    // Whichever page size the host could provide, lookups read the copy and agree with the tree.
+    size_t page = tree.cache_inner_layers();
+    EXPECT_GT(page, 0u);
+    EXPECT_EQ(tree.inner_page_bytes(), page);
+
+    std::vector<int> one_leaf(data.begin(), data.begin() + 10);
+    runtime_bplus<> single(one_leaf);
+    EXPECT_EQ(single.cache_inner_layers(), 0u);
+
+    for (size_t batch = 0; batch + batch_size <= n; batch += batch_size) {
+        int results[batch_size];
+        tree.lower_bound_batch<batch_size>(&queries[batch], results);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            int query = queries[batch + i];
+            auto result = std::lower_bound(data.begin(), data.end(), query);
+            if (result != data.end()) {
+                EXPECT_EQ(results[i], *result) << "query value: " << query;
+                EXPECT_EQ(tree.lower_bound(query), *result) << "query value: " << query;
+            }
+        }
+    }
+}
+
+TEST(runtime_bplus_bulk, matches_lower_bound_in_caller_order) {
+    auto data = generate_random_data(100000);
+    std::sort(data.begin(), data.end());
+    runtime_bplus<> tree(data);
+
+    // Unsorted with many repeats, already sorted, and keys drawn from the tree itself.
+    auto queries = generate_random_data(50000);
+    for (size_t i = 0; i < queries.size(); i += 3) {
+        queries[i] = queries[i / 2];
+    }
+    auto sorted = queries;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<int> existing(data.begin(), data.begin() + 1000);
+    std::shuffle(existing.begin(), existing.end(), std::mt19937(1));
+
+    for (auto* batch : {&queries, &sorted, &existing}) {
+        std::vector<int> results(batch->size());
+        tree.lower_bound_bulk(*batch, results);
+
+        for (size_t i = 0; i < batch->size(); i++) {
+            int query = (*batch)[i];
+            auto result = std::lower_bound(data.begin(), data.end(), query);
+            if (result != data.end()) {
+                EXPECT_EQ(results[i], *result)
+                    << "Mismatch at index " << i << ", query value: " << query;
+            }
+        }
+    }
+
+    // A single leaf, and 64-bit signed keys that need every radix pass.
+    std::vector<int> few = {3, 5, 9};
+    runtime_bplus<> small(few);
+    std::vector<int> small_queries = {9, 0, 4, 4, 6, 3};
+    std::vector<int> small_results(small_queries.size());
+    small.lower_bound_bulk(small_queries, small_results);
+    EXPECT_EQ(small_results, (std::vector<int>{9, 3, 5, 5, 9, 3}));
+
+    auto wide = generate_random_data<int64_t>(100000);
+    std::sort(wide.begin(), wide.end());
+    runtime_bplus<int64_t> wide_tree(wide);
+    auto wide_queries = generate_random_data<int64_t>(20000);
+    std::vector<int64_t> wide_results(wide_queries.size());
+    wide_tree.lower_bound_bulk(wide_queries, wide_results);
+    for (size_t i = 0; i < wide_queries.size(); i++) {
+        auto result = std::lower_bound(wide.begin(), wide.end(), wide_queries[i]);
+        if (result != wide.end()) {
+            EXPECT_EQ(wide_results[i], *result) << "query value: " << wide_queries[i];
+        }
+    }
+}
+
+// Counts the trees alive, so that the test can see old versions being freed.
+struct counted_tree : runtime_bplus<> {
+    static inline std::atomic<int> live = 0;
+
+    explicit counted_tree(std::span<const int> data) : runtime_bplus<>(data) {
+        live++;
+    }
+
+    ~counted_tree() {
+        live--;
+    }
+};
+
+TEST(published, readers_see_whole_versions_while_swapped) {
+    // Version v holds the keys v, 100 + v, 200 + v, ..., so one lookup names the version and a
+    // second checks it came from the same tree.
+    auto build = [](int v) {
+        std::vector<int> keys(1000);
+        for (int i = 0; i < 1000; i++) {
+            keys[i] = i * 100 + v;
+        }
+        return std::make_unique<counted_tree>(keys);
+    };
+
+    constexpr int versions = 50;
+    std::atomic<int> failures = 0;
+    std::atomic<bool> done = false;
+
+    {
+        published<counted_tree> index(build(0));
+
+        std::vector<std::thread> readers;
+        for (int r = 0; r < 3; r++) {
+            readers.emplace_back([&] {
+                published<counted_tree>::reader reader(index);
+                int last = 0;
+                while (!done.load()) {
+                    const counted_tree& tree = reader.get();
+                    int v = tree.lower_bound(0);
+                    if (v < last || v >= versions || tree.lower_bound(v + 1) != 100 + v) {
+                        failures++;
+                    }
+                    last = v;
+                    reader.quiescent();
+                }
+            });
+        }
+
+        for (int v = 1; v < versions; v++) {
+            index.publish(build(v));
+            EXPECT_EQ(counted_tree::live.load(), 1);
+        }
+        EXPECT_EQ(index.version(), static_cast<uint64_t>(versions - 1));
+
+        done = true;
+        for (auto& thread : readers) {
+            thread.join();
+        }
+    }
+
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(counted_tree::live.load(), 0);
+}
+
+template <typename P>
+static void expect_prefix_bplus_ranks(const std::vector<std::string>& keys,
+                                      const std::vector<std::string>& probes) {
+    prefix_bplus<P> tree(keys);
+    ASSERT_EQ(tree.keys(), keys.size());
+
+    constexpr size_t batch_size = 16;
+    for (size_t batch = 0; batch + batch_size <= probes.size(); batch += batch_size) {
+        std::string_view targets[batch_size];
+        size_t ranks[batch_size];
+        std::copy_n(probes.begin() + batch, batch_size, targets);
+        tree.template lower_bound_rank_batch<batch_size>(targets, ranks);
+
+        for (size_t i = 0; i < batch_size; i++) {
+            std::string_view probe = targets[i];
+            size_t expected = std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+            EXPECT_EQ(tree.lower_bound_rank(probe), expected) << "query value: " << probe;
+            EXPECT_EQ(ranks[i], expected) << "query value: " << probe;
+        }
+    }
+}
+
+TEST(prefix_bplus, matches_lower_bound_on_strings_and_composite_keys) {
+    // URLs under one host, so every key shares a long prefix, and short keys where 4-byte
+    // prefixes often tie.
+    auto urls = generate_string_data(50000, "https://example.com/");
+    auto words = generate_string_data(50000);
+
+    // (tenant, ts) pairs from a few tenants, which share leading zero bytes.
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<uint32_t> tenant(0, 20);
+    std::uniform_int_distribution<int64_t> ts(-1000000, 1000000);
+    std::vector<std::string> composite;
+    for (int i = 0; i < 50000; i++) {
+        composite.push_back(big_endian_key(tenant(rng), ts(rng)));
+    }
+    std::sort(composite.begin(), composite.end());
+
+    // Keys shorter than a prefix, with zero bytes, and the empty key.
+    std::vector<std::string> awkward = {"", std::string(1, '\0'), std::string("a\0", 2), "a",
+                                        std::string("a\0\0b", 4), "ab", "abcdefghij", "abcdefghik"};
+    std::sort(awkward.begin(), awkward.end());
+
+    for (auto* keys : {&urls, &words, &composite, &awkward}) {
+        // Missing keys, existing keys and their prefixes, and both ends.
+        auto probes = generate_string_data(2000);
+        auto below = generate_string_data(1000, "https://example.com/");
+        probes.insert(probes.end(), below.begin(), below.end());
+        for (size_t i = 0; i < keys->size(); i += 37) {
+            probes.push_back((*keys)[i]);
+            probes.push_back((*keys)[i].substr(0, (*keys)[i].size() / 2));
+            probes.push_back((*keys)[i] + "a");
+        }
+        probes.push_back("");
+        probes.push_back(std::string(30, '\xff'));
+        probes.push_back("https://example.com");
+        probes.push_back("https://example.con");
+        while (probes.size() % 16 != 0) {
+            probes.push_back("a");
+        }
+
+        expect_prefix_bplus_ranks<uint64_t>(*keys, probes);
+        expect_prefix_bplus_ranks<uint32_t>(*keys, probes);
+    }
+
+    prefix_bplus<> empty(std::vector<std::string>{});
+    EXPECT_EQ(empty.lower_bound_rank("a"), 0u);
+    EXPECT_EQ(empty.lower_bound("a"), "");
+
+    prefix_bplus<> tree(urls);
+    EXPECT_EQ(tree.common_prefix(), std::string_view("https://example.com/").size());
+    EXPECT_EQ(tree.lower_bound(urls[100]), urls[100]);
+}
+
+TEST(runtime_bplus_probe, bitmap_and_matches_agree_with_binary_search) {
+    // Repeated keys, INT_MAX as a real key in one tree and only as the padding sentinel in the
+    // other, and columns that don't fill their last batch.
+    std::vector<int> with_max = generate_random_data(5000);
+    for (size_t i = 0; i < with_max.size(); i += 7) {
+        with_max[i] = with_max[i / 2];
+    }
+    with_max.push_back(INT_MAX);
+    std::sort(with_max.begin(), with_max.end());
+
+    std::vector<int> without_max(with_max.begin(), with_max.end() - 1);
+    std::vector<int> sixteen(with_max.begin(), with_max.begin() + 16);
+
+    for (auto* keys : {&with_max, &without_max, &sixteen}) {
+        runtime_bplus<> tree(*keys);
+
+        for (size_t column_size : {0, 1, 63, 64, 1000, 10007}) {
+            std::vector<int> column = generate_random_data(column_size);
+            for (size_t i = 0; i < column_size; i += 2) {
+                column[i] = (*keys)[i % keys->size()];
+            }
+            if (column_size > 3) {
+                column[1] = INT_MAX;
+                column[3] = INT_MIN;
+            }
+
+            std::vector<uint64_t> bitmap((column_size + 63) / 64, ~uint64_t{0});
+            tree.probe_bitmap(column, bitmap);
+
+            std::vector<size_t> rows;
+            std::vector<size_t> ranks;
+            tree.probe_matches(column, rows, &ranks);
+
+            std::vector<size_t> expected_rows;
+            for (size_t i = 0; i < column_size; i++) {
+                bool present = std::binary_search(keys->begin(), keys->end(), column[i]);
+                EXPECT_EQ(bool(bitmap[i / 64] >> (i % 64) & 1), present)
+                    << "row " << i << ", value: " << column[i];
+                if (present) {
+                    expected_rows.push_back(i);
+                }
+            }
+            if (column_size % 64 != 0) {
+                EXPECT_EQ(bitmap.back() >> (column_size % 64), 0u);
+            }
+
+            EXPECT_EQ(rows, expected_rows);
+            ASSERT_EQ(ranks.size(), rows.size());
+            for (size_t m = 0; m < rows.size(); m++) {
+                auto first = std::lower_bound(keys->begin(), keys->end(), column[rows[m]]);
+                EXPECT_EQ(ranks[m], static_cast<size_t>(first - keys->begin()));
+            }
+        }
+    }
+}
+
+TEST(tree_arena, packs_trees_and_recycles_released_generations) {
+    tree_arena arena(size_t{4} << 20);
+
+    auto build = [&](size_t count) {
+        std::vector<std::vector<int>> keys;
+        std::vector<std::unique_ptr<runtime_bplus<>>> trees;
+        for (size_t i = 0; i < count; i++) {
+            keys.push_back(generate_random_data(1 + i * 37 % 3000));
+            std::sort(keys.back().begin(), keys.back().end());
+            trees.push_back(std::make_unique<runtime_bplus<>>(keys.back(), arena));
+        }
+        return std::pair{std::move(keys), std::move(trees)};
+    };
+
+    auto check = [](const auto& keys, const auto& trees) {
+        std::vector<int> queries = generate_random_data(100);
+        for (size_t i = 0; i < trees.size(); i++) {
+            for (int query : queries) {
+                auto expected = std::lower_bound(keys[i].begin(), keys[i].end(), query);
+                EXPECT_EQ(trees[i]->lower_bound_rank(query),
+                          static_cast<size_t>(expected - keys[i].begin()))
+                    << "tree " << i << ", query value: " << query;
+            }
+        }
+    };
+
+    auto [old_keys, old_trees] = build(200);
+    size_t packed = 0;
+    for (const auto& tree : old_trees) {
+        packed += tree->bytes();
+    }
+    EXPECT_EQ(arena.bytes_used(), packed);
+    EXPECT_LT(arena.bytes_mapped(), packed + (size_t{8} << 20));
+    check(old_keys, old_trees);
+
+    uint64_t old_generation = arena.generation();
+    arena.next_generation();
+    auto [new_keys, new_trees] = build(50);
+    size_t mapped = arena.bytes_mapped();
+
+    old_trees.clear();
+    arena.release(old_generation);
+    EXPECT_LT(arena.bytes_used(), packed);
+    EXPECT_EQ(arena.bytes_mapped(), mapped);
+    check(new_keys, new_trees);
+
+    // The released chunks are reused rather than new ones mapped.
+    arena.next_generation();
+    auto [more_keys, more_trees] = build(100);
+    EXPECT_EQ(arena.bytes_mapped(), mapped);
+    check(more_keys, more_trees);
+    check(new_keys, new_trees);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for splitting lookups over many cores. The calling thread takes
+// part as worker 0, so a pool of one thread spawns nothing and runs inline.
+//
+// parallel_for() hands each worker a contiguous share of the indices up front. A worker drains its
+// own share first and then steals from the others, claiming one index at a time with a fetch_add
+// on the victim's counter. With uniform batches almost every claim hits the worker's own cache
+// line, and a worker that finishes early (or was descheduled) still can't leave the job waiting.
+class thread_pool {
+public:
+    explicit thread_pool(size_t num_threads = std::thread::hardware_concurrency(),
+                         bool pin_threads = false)
+        : _num_threads(std::max<size_t>(num_threads, 1)),
+          _shares(std::make_unique<share[]>(_num_threads)) {
+        for (size_t id = 1; id < _num_threads; id++) {
+            _workers.emplace_back([this, id] { worker(id); });
+            if (pin_threads) {
+                pin(_workers.back(), id);
+            }
+        }
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard lock(_mutex);
+            _stop = true;
+        }
+        _start.notify_all();
+
+        for (auto& thread : _workers) {
+            thread.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    size_t size() const noexcept {
+        return _num_threads;
+    }
+
+    // Calls task(i) for every i in [0, count), blocking until all calls have returned. Calls are
+    // spread across the pool in no particular order.
+    void parallel_for(size_t count, std::function<void(size_t)> task) {
+        for (size_t id = 0; id < _num_threads; id++) {
+            _shares[id].next.store(count * id / _num_threads, std::memory_order_relaxed);
+            _shares[id].end = count * (id + 1) / _num_threads;
+        }
+
+        {
+            std::lock_guard lock(_mutex);
+            _task = std::move(task);
+            _running = _num_threads - 1;
+            _generation++;
+        }
+        _start.notify_all();
+
+        drain(0);
+
+        std::unique_lock lock(_mutex);
+        _done.wait(lock, [this] { return _running == 0; });
+        _task = nullptr;
+    }
+
+private:
+    struct alignas(64) share {
+        std::atomic<size_t> next;
+        size_t end;
+    };
+
+    size_t _num_threads;
+    std::unique_ptr<share[]> _shares;
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _start;
+    std::condition_variable _done;
+    std::function<void(size_t)> _task;
+    size_t _generation = 0;
+    size_t _running = 0;
+    bool _stop = false;
+
+    void worker(size_t id) {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock lock(_mutex);
+                _start.wait(lock, [&] { return _stop || _generation != seen; });
+                if (_stop) {
+                    return;
+                }
+                seen = _generation;
+            }
+
+            drain(id);
+
+            {
+                std::lock_guard lock(_mutex);
+                _running--;
+            }
+            _done.notify_one();
+        }
+    }
+
+    // Own share first, then everyone else's, starting with our neighbour.
+    void drain(size_t id) {
+        for (size_t offset = 0; offset < _num_threads; offset++) {
+            share& victim = _shares[(id + offset) % _num_threads];
+
+            size_t i;
+            while ((i = victim.next.fetch_add(1, std::memory_order_relaxed)) < victim.end) {
+                _task(i);
+            }
+        }
+    }
+
+    // Best effort: on a host with fewer cores than threads we simply run unpinned.
+    static void pin(std::thread& thread, size_t id) {
+        size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(id % cores, &cpuset);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+    }
+};
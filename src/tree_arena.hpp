@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "huge_pages.hpp"
+
+// Storage for many small trees packed together. A tree built on its own rounds its allocation up
+// to a 2MiB huge page, so a 1,000 key tree costs 2MiB, and ten thousand of them each take their
+// own TLB entry. An arena instead hands out 64 byte aligned pieces of large chunks backed by huge
+// pages (see huge_pages.hpp), so small trees share both the pages and the TLB entries.
+//
+// Nothing is freed piece by piece. Allocations belong to the arena's current generation, and
+// release() frees a whole generation at once, such as the trees of a rebuild that has since been
+// replaced. Released chunks are kept for later generations rather than unmapped, as huge pages
+// can be hard to get back. An arena is not thread safe.
+class tree_arena {
+public:
+    static constexpr size_t alignment = 64;
+
+    // Chunks are at least chunk_bytes, rounded up to the page size obtained. With 1GiB pages
+    // allowed, that means a whole 1GiB per chunk, so they are only tried if options ask for them.
+    explicit tree_arena(size_t chunk_bytes = size_t{64} << 20,
+                        huge_pages::options options = {.largest = huge_pages::page_2m})
+        : _chunk_bytes(chunk_bytes), _options(options) {}
+
+    ~tree_arena() {
+        for (const chunk& c : _chunks) {
+            huge_pages::unmap(c.region);
+        }
+        for (const chunk& c : _spare) {
+            huge_pages::unmap(c.region);
+        }
+    }
+
+    tree_arena(const tree_arena&) = delete;
+    tree_arena& operator=(const tree_arena&) = delete;
+
+    // At least bytes, 64 byte aligned, from the current generation. Throws std::bad_alloc if a new
+    // chunk was needed and could not be mapped.
+    void* allocate(size_t bytes) {
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+
+        if (_chunks.empty() || _chunks.back().generation != _generation ||
+            _chunks.back().used + bytes > _chunks.back().region.bytes) {
+            add_chunk(bytes);
+        }
+
+        chunk& c = _chunks.back();
+        void* piece = static_cast<char*>(c.region.addr) + c.used;
+        c.used += bytes;
+        _bytes_used += bytes;
+        return piece;
+    }
+
+    // The generation allocate() currently draws from.
+    uint64_t generation() const noexcept {
+        return _generation;
+    }
+
+    // Closes the current generation: later allocations go into a new one. Returns the new one.
+    uint64_t next_generation() noexcept {
+        return ++_generation;
+    }
+
+    // Frees everything allocated in generation, which must hold no live trees.
+    void release(uint64_t generation) {
+        std::erase_if(_chunks, [&](chunk& c) {
+            if (c.generation != generation) {
+                return false;
+            }
+
+            _bytes_used -= c.used;
+            c.used = 0;
+            _spare.push_back(c);
+            return true;
+        });
+    }
+
+    // Bytes handed out to generations not yet released.
+    size_t bytes_used() const noexcept {
+        return _bytes_used;
+    }
+
+    // Bytes mapped, spare chunks included.
+    size_t bytes_mapped() const noexcept {
+        size_t bytes = 0;
+        for (const chunk& c : _chunks) {
+            bytes += c.region.bytes;
+        }
+        for (const chunk& c : _spare) {
+            bytes += c.region.bytes;
+        }
+        return bytes;
+    }
+
+    // The page size behind the most recent chunk, or 0 if there is none yet.
+    size_t page_bytes() const noexcept {
+        return _chunks.empty() ? 0 : _chunks.back().region.page_bytes;
+    }
+
+private:
+    struct chunk {
+        huge_pages::region region;
+        size_t used = 0;
+        uint64_t generation = 0;
+    };
+
+    size_t _chunk_bytes;
+    huge_pages::options _options;
+    uint64_t _generation = 0;
+    size_t _bytes_used = 0;
+    std::vector<chunk> _chunks;  // in order of mapping; the last one is being filled
+    std::vector<chunk> _spare;
+
+    // Starts filling a chunk of at least bytes: a released one if any is big enough, otherwise a
+    // new one. Whatever is left of the previous chunk is abandoned.
+    void add_chunk(size_t bytes) {
+        for (size_t i = 0; i < _spare.size(); i++) {
+            if (_spare[i].region.bytes >= bytes) {
+                chunk reused = _spare[i];
+                _spare.erase(_spare.begin() + i);
+                reused.generation = _generation;
+                _chunks.push_back(reused);
+                return;
+            }
+        }
+
+        huge_pages::region region = huge_pages::map(std::max(_chunk_bytes, bytes), _options);
+        if (region.addr == nullptr) {
+            throw std::bad_alloc();
+        }
+        _chunks.push_back({region, 0, _generation});
+    }
+};
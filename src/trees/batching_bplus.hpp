@@ -1,6 +1,7 @@
 #include <immintrin.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <climits>
 #include <cmath>
 #include <cstdio>
@@ -9,23 +10,28 @@
 #include <span>
 
 #include "common.hpp"
+#include "isa.hpp"
+#include "node.hpp"
 
-template <size_t N, size_t B>
+// Width is the number of keys per node: one cache line's worth by default, or half or a
+// multiple of that. ./profile tune measures which width and B suit each size on a given host.
+template <size_t N, size_t B, typename T = int, int Width = node<T>::block_len>
 class batching_bplus {
 private:
+    static constexpr int block_len = Width;
+
     static constexpr int block_count(int num_keys) {
         // block_count = ceil(num_keys / block_length)
-        return (num_keys + (constants::block_len - 1)) / constants::block_len;
+        return (num_keys + (block_len - 1)) / block_len;
     }
 
     static constexpr int parent_layer_keys(int num_keys) {
         // parent_size = ceil(blocks_on_layer / children_per_block) * block_len
-        return (block_count(num_keys) + constants::block_len) / (constants::block_len + 1) *
-               constants::block_len;
+        return (block_count(num_keys) + block_len) / (block_len + 1) * block_len;
     }
 
     static constexpr int height(int num_keys) {
-        if (num_keys <= constants::block_len) {
+        if (num_keys <= block_len) {
             return 1;
         }
 
@@ -35,7 +41,7 @@ private:
     static constexpr size_t offset(int layer) {
         size_t i = 0, num_keys = N;
         while (layer--) {
-            i += block_count(num_keys) * constants::block_len;
+            i += block_count(num_keys) * block_len;
             num_keys = parent_layer_keys(num_keys);
         }
         return i;
@@ -45,12 +51,12 @@ private:
     static constexpr size_t size = offset(num_layers);  // offset of non-existent last layer
 
 public:
-    batching_bplus(std::span<const int> data) {
-        size_t bytes = size * sizeof(int);
+    batching_bplus(std::span<const T> data) {
+        size_t bytes = size * sizeof(T);
         size_t padded_bytes =
             (bytes + constants::page_size - 1) / constants::page_size * constants::page_size;
 
-        _tree = static_cast<int*>(std::aligned_alloc(constants::page_size, padded_bytes));
+        _tree = static_cast<T*>(std::aligned_alloc(constants::page_size, padded_bytes));
         madvise(_tree, padded_bytes, MADV_HUGEPAGE);
 
         build(data);
@@ -60,67 +66,111 @@ public:
         std::free(_tree);
     }
 
-    void lower_bound_batch(const int* queries, int* results) const noexcept {
-        int positions[B]{};
+    void lower_bound_batch(const T* queries, T* results) const noexcept {
+        isa::dispatch([&](auto kernel) {
+            int positions[B];
+            descend(kernel, queries, positions);
 
-        __m512i targets[B];
-        for (size_t i = 0; i < B; i++) {
-            targets[i] = _mm512_set1_epi32(queries[i]);
-        }
-
-        for (int h = num_layers - 1; h > 0; h--) {
             for (size_t i = 0; i < B; i++) {
-                int k = positions[i];
+                T* leaf_block = _tree + positions[i] * block_len;
+                int key_i = isa::first_ge_n<block_len>(kernel, queries[i], leaf_block);
+                results[i] = leaf_block[key_i];
+            }
+        });
+    }
 
-                int key_i = first_ge(targets[i], _tree + offset(h) + k * constants::block_len);
-                positions[i] = k * (constants::block_len + 1) + key_i;
+    // The rank is the index of the lower bound in the sorted input, or N if there is none. The
+    // leaf layer is the input itself, so this is just the position we stopped at.
+    void lower_bound_rank_batch(const T* queries, size_t* ranks) const noexcept {
+        isa::dispatch([&](auto kernel) {
+            int positions[B];
+            descend(kernel, queries, positions);
 
-                int* next_block = _tree + offset(h - 1) + positions[i] * constants::block_len;
-                _mm_prefetch(reinterpret_cast<const char*>(next_block), _MM_HINT_T0);
+            for (size_t i = 0; i < B; i++) {
+                T* leaf_block = _tree + positions[i] * block_len;
+                size_t rank = positions[i] * block_len +
+                              isa::first_ge_n<block_len>(kernel, queries[i], leaf_block);
+                ranks[i] = std::min(rank, N);
             }
+        });
+    }
+
+    // The number of keys in [los[i], his[i]) for each of the B ranges. This is two batched
+    // descents, one per bound; the keys in between are never read.
+    void count_batch(const T* los, const T* his, size_t* counts) const noexcept {
+        size_t firsts[B];
+        lower_bound_rank_batch(los, firsts);
+        lower_bound_rank_batch(his, counts);
+
+        for (size_t i = 0; i < B; i++) {
+            counts[i] = std::max(counts[i], firsts[i]) - firsts[i];
         }
+    }
+
+    // The keys in [los[i], his[i]) for each of the B ranges, as spans over the leaf layer.
+    void range_batch(const T* los, const T* his, std::span<const T>* ranges) const noexcept {
+        size_t firsts[B];
+        size_t lasts[B];
+        lower_bound_rank_batch(los, firsts);
+        lower_bound_rank_batch(his, lasts);
 
         for (size_t i = 0; i < B; i++) {
-            int* leaf_block = _tree + positions[i] * constants::block_len;
-            results[i] = leaf_block[first_ge(targets[i], leaf_block)];
+            ranges[i] = {_tree + firsts[i], std::max(lasts[i], firsts[i]) - firsts[i]};
         }
     }
 
 private:
-    int* _tree;
+    T* _tree;
 
-    void build(std::span<const int> data) {
-        memcpy(_tree, data.data(), N * sizeof(int));
-        for (size_t i = N; i < size; i++) {
-            _tree[i] = INT_MAX;
+    // Walks the batch down to the leaf layer, prefetching the next block of each query while the
+    // others are searched. Leaves the leaf block index of each query in positions.
+    template <typename Isa>
+    void descend(Isa kernel, const T* queries, int* positions) const noexcept {
+        for (size_t i = 0; i < B; i++) {
+            positions[i] = 0;
         }
 
+        for (int h = num_layers - 1; h > 0; h--) {
+            for (size_t i = 0; i < B; i++) {
+                int k = positions[i];
+
+                const T* block = _tree + offset(h) + k * block_len;
+                int key_i = isa::first_ge_n<block_len>(kernel, queries[i], block);
+                positions[i] = k * (block_len + 1) + key_i;
+
+                T* next_block = _tree + offset(h - 1) + positions[i] * block_len;
+                for (int line = 0; line < block_len; line += node<T>::block_len) {
+                    _mm_prefetch(reinterpret_cast<const char*>(next_block + line), _MM_HINT_T0);
+                }
+            }
+        }
+    }
+
+    void build(std::span<const T> data) {
+        memcpy(_tree, data.data(), N * sizeof(T));
+        std::fill(_tree + N, _tree + offset(1), node<T>::max_key);
+
         for (size_t h = 1; h < num_layers; h++) {
             size_t layer_start = offset(h);
             size_t layer_end = offset(h + 1);
 
+            // The leftmost leaf index under the subtree of child c of this layer is c * stride.
+            size_t stride = block_len;
+            for (size_t l = 0; l < h - 1; l++) {
+                stride *= (block_len + 1);
+            }
+
             for (size_t i = 0; i < (layer_end - layer_start); i++) {
-                int block = i / constants::block_len;
-                int block_key_offset = i - block * constants::block_len;
+                int block = i / block_len;
+                int block_key_offset = i - block * block_len;
 
-                int block_offset_on_new_layer = block * (constants::block_len + 1);
+                int block_offset_on_new_layer = block * (block_len + 1);
                 int right_key_offset = (block_offset_on_new_layer + block_key_offset) + 1;
 
-                int leftmost_block = right_key_offset;
-                for (size_t l = 0; l < h - 1; l++) {
-                    leftmost_block *= (constants::block_len + 1);
-                }
-
-                size_t leftmost_index = leftmost_block * constants::block_len;
-                _tree[layer_start + i] = (leftmost_index < N ? _tree[leftmost_index] : INT_MAX);
+                size_t leftmost_index = right_key_offset * stride;
+                _tree[layer_start + i] =
+                    (leftmost_index < N ? _tree[leftmost_index] : node<T>::max_key);
             }
         }
     }
-
-    static_assert(constants::block_len == 16);
-    int first_ge(__m512i target_vec, int* block) const noexcept {
-        __m512i data = _mm512_load_si512(reinterpret_cast<__m512i*>(block));
-        __mmask16 mask = _mm512_cmpge_epi32_mask(data, target_vec);
-        return __tzcnt_u16(mask);
-    }
 };
@@ -1,31 +1,38 @@
 #include <immintrin.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <climits>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <span>
+#include <utility>
 
 #include "common.hpp"
+#include "isa.hpp"
+#include "node.hpp"
 
-template <size_t N>
+// Width is the number of keys per node: one cache line's worth by default, or half or a
+// multiple of that. ./profile tune measures which width suits each size on a given host.
+template <size_t N, typename T = int, int Width = node<T>::block_len>
 class bplus {
 private:
+    static constexpr int block_len = Width;
+
     static constexpr int block_count(int num_keys) {
         // block_count = ceil(num_keys / block_length)
-        return (num_keys + (constants::block_len - 1)) / constants::block_len;
+        return (num_keys + (block_len - 1)) / block_len;
     }
 
     static constexpr int parent_layer_keys(int num_keys) {
         // parent_size = ceil(blocks_on_layer / children_per_block) * block_len
-        return (block_count(num_keys) + constants::block_len) / (constants::block_len + 1) *
-               constants::block_len;
+        return (block_count(num_keys) + block_len) / (block_len + 1) * block_len;
     }
 
     static constexpr int height(int num_keys) {
-        if (num_keys <= constants::block_len) {
+        if (num_keys <= block_len) {
             return 1;
         }
 
@@ -35,7 +42,7 @@ private:
     static constexpr size_t offset(int layer) {
         size_t i = 0, num_keys = N;
         while (layer--) {
-            i += block_count(num_keys) * constants::block_len;
+            i += block_count(num_keys) * block_len;
             num_keys = parent_layer_keys(num_keys);
         }
         return i;
@@ -45,12 +52,12 @@ private:
     static constexpr size_t size = offset(num_layers);  // offset of non-existent last layer
 
 public:
-    bplus(std::span<const int> data) {
-        size_t bytes = size * sizeof(int);
+    bplus(std::span<const T> data) {
+        size_t bytes = size * sizeof(T);
         size_t padded_bytes =
             (bytes + constants::page_size - 1) / constants::page_size * constants::page_size;
 
-        _tree = static_cast<int*>(std::aligned_alloc(constants::page_size, padded_bytes));
+        _tree = static_cast<T*>(std::aligned_alloc(constants::page_size, padded_bytes));
         madvise(_tree, padded_bytes, MADV_HUGEPAGE);
 
         build(data);
@@ -60,55 +67,79 @@ public:
         std::free(_tree);
     }
 
-    int lower_bound(int target) const noexcept {
-        int k = 0;
+    T lower_bound(T target) const noexcept {
+        return _tree[isa::dispatch([&](auto kernel) { return position_with(kernel, target); })];
+    }
 
-        __m512i target_vec = _mm512_set1_epi32(target);
-        for (int h = num_layers - 1; h > 0; h--) {
-            int i = first_ge(target_vec, _tree + offset(h) + k);
+    // The index of the lower bound in the sorted input, or N if there is none.
+    size_t lower_bound_rank(T target) const noexcept {
+        return std::min(isa::dispatch([&](auto kernel) { return position_with(kernel, target); }),
+                        N);
+    }
 
-            k = k * (constants::block_len + 1) + i * constants::block_len;
-        }
+    // The keys in [lo, hi), straight out of the leaf layer.
+    std::span<const T> range(T lo, T hi) const noexcept {
+        auto [first, last] = ranks(lo, hi);
+        return {_tree + first, last - first};
+    }
 
-        int i = first_ge(target_vec, _tree + k);
-        return _tree[k + i];
+    // The number of keys in [lo, hi). Only the two boundary leaves are read.
+    size_t count(T lo, T hi) const noexcept {
+        auto [first, last] = ranks(lo, hi);
+        return last - first;
     }
 
 private:
-    int* _tree;
+    T* _tree;
+
+    // Both descents are issued from the same function so that their cache misses overlap.
+    std::pair<size_t, size_t> ranks(T lo, T hi) const noexcept {
+        return isa::dispatch([&](auto kernel) {
+            size_t first = std::min(position_with(kernel, lo), N);
+            size_t last = std::min(position_with(kernel, hi), N);
+            return std::pair{first, std::max(first, last)};
+        });
+    }
+
+    // The index into the leaf layer of the lower bound of target.
+    template <typename Isa>
+    size_t position_with(Isa kernel, T target) const noexcept {
+        int k = 0;
 
-    void build(std::span<const int> data) {
-        memcpy(_tree, data.data(), N * sizeof(int));
-        for (size_t i = N; i < size; i++) {
-            _tree[i] = INT_MAX;
+        for (int h = num_layers - 1; h > 0; h--) {
+            int i = isa::first_ge_n<block_len>(kernel, target, _tree + offset(h) + k);
+
+            k = k * (block_len + 1) + i * block_len;
         }
 
+        return k + isa::first_ge_n<block_len>(kernel, target, _tree + k);
+    }
+
+    void build(std::span<const T> data) {
+        memcpy(_tree, data.data(), N * sizeof(T));
+        std::fill(_tree + N, _tree + offset(1), node<T>::max_key);
+
         for (size_t h = 1; h < num_layers; h++) {
             size_t layer_start = offset(h);
             size_t layer_end = offset(h + 1);
 
+            // The leftmost leaf index under the subtree of child c of this layer is c * stride.
+            size_t stride = block_len;
+            for (size_t l = 0; l < h - 1; l++) {
+                stride *= (block_len + 1);
+            }
+
             for (size_t i = 0; i < (layer_end - layer_start); i++) {
-                int block = i / constants::block_len;
-                int block_key_offset = i - block * constants::block_len;
+                int block = i / block_len;
+                int block_key_offset = i - block * block_len;
 
-                int block_offset_on_new_layer = block * (constants::block_len + 1);
+                int block_offset_on_new_layer = block * (block_len + 1);
                 int right_key_offset = (block_offset_on_new_layer + block_key_offset) + 1;
 
-                int leftmost_block = right_key_offset;
-                for (size_t l = 0; l < h - 1; l++) {
-                    leftmost_block *= (constants::block_len + 1);
-                }
-
-                size_t leftmost_index = leftmost_block * constants::block_len;
-                _tree[layer_start + i] = (leftmost_index < N ? _tree[leftmost_index] : INT_MAX);
+                size_t leftmost_index = right_key_offset * stride;
+                _tree[layer_start + i] =
+                    (leftmost_index < N ? _tree[leftmost_index] : node<T>::max_key);
             }
         }
     }
-
-    static_assert(constants::block_len == 16);
-    int first_ge(__m512i target_vec, int* block) const noexcept {
-        __m512i data = _mm512_load_si512(reinterpret_cast<__m512i*>(block));
-        __mmask16 mask = _mm512_cmpge_epi32_mask(data, target_vec);
-        return __tzcnt_u16(mask);
-    }
 };
@@ -1,6 +1,7 @@
 #include <immintrin.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <climits>
 #include <cmath>
 #include <cstdio>
@@ -8,6 +9,8 @@
 #include <span>
 
 #include "common.hpp"
+#include "isa.hpp"
+#include "node.hpp"
 
 class btree {
 public:
@@ -23,6 +26,11 @@ public:
 
         size_t pos = 0;
         build(data, pos);
+
+        // Level l of the tree starts at block (17^l - 1) / 16.
+        for (size_t first = 0; first < _nblocks; first = child(first, 0)) {
+            _height++;
+        }
     }
 
     ~btree() {
@@ -30,11 +38,49 @@ public:
     }
 
     int lower_bound(int target) const noexcept {
+        return isa::dispatch([&](auto kernel) { return lower_bound_with(kernel, target); });
+    }
+
+    // lower_bound() for B queries at once, interleaved so that their cache misses overlap. Each
+    // query takes exactly height() steps whichever leaf it ends in, so the loop has no exit branch
+    // to mispredict: a query that has already left the tree searches the root again, which is in
+    // cache, and keeps its result. After each step the child it moves to is prefetched, and with
+    // Speculate so are all 17 of that child's children, since they are contiguous, putting the
+    // fetch two levels ahead at the cost of 17 lines per query per level.
+    template <size_t B, bool Speculate = false>
+    void lower_bound_batch(const int* queries, int* results) const noexcept {
+        isa::dispatch([&](auto kernel) {
+            size_t blocks[B];
+            for (size_t i = 0; i < B; i++) {
+                blocks[i] = 0;
+                results[i] = 0;
+            }
+
+            for (int h = 0; h < _height; h++) {
+                for (size_t i = 0; i < B; i++) {
+                    step<Speculate>(kernel, queries[i], blocks[i], results[i]);
+                }
+            }
+        });
+    }
+
+    // The number of levels, each of which every batched query takes one step through.
+    int height() const noexcept {
+        return _height;
+    }
+
+private:
+    int* _tree;
+    size_t _nblocks;
+    int _height = 0;
+
+    template <typename Isa>
+    int lower_bound_with(Isa, int target) const noexcept {
         int found = 0;
 
         size_t block = 0;
         while (block < _nblocks) {
-            int i = first_ge(target, &_tree[block * constants::block_len]);
+            int i = Isa::first_ge(target, &_tree[block * constants::block_len]);
             if (i < constants::block_len) {
                 found = _tree[block * constants::block_len + i];
             }
@@ -45,9 +91,33 @@ public:
         return found;
     }
 
-private:
-    int* _tree;
-    size_t _nblocks;
+    template <bool Speculate, typename Isa>
+    void step(Isa, int target, size_t& block, int& found) const noexcept {
+        constexpr int block_len = constants::block_len;
+
+        bool inside = block < _nblocks;
+        const int* keys = &_tree[(inside ? block : 0) * block_len];
+        int i = Isa::first_ge(target, keys);
+
+        // Clamped, as keys[block_len] may be past the end of the tree.
+        int key = keys[std::min(i, block_len - 1)];
+        found = inside && i < block_len ? key : found;
+
+        block = child(block, i);
+        size_t next = std::min(block, _nblocks - 1);
+        _mm_prefetch(reinterpret_cast<const char*>(&_tree[next * block_len]), _MM_HINT_T0);
+
+        if constexpr (Speculate) {
+            size_t grandchildren = child(block, 0);
+            if (grandchildren < _nblocks) {
+                size_t last = std::min(grandchildren + block_len, _nblocks - 1);
+                for (size_t g = grandchildren; g <= last; g++) {
+                    _mm_prefetch(reinterpret_cast<const char*>(&_tree[g * block_len]),
+                                 _MM_HINT_T0);
+                }
+            }
+        }
+    }
 
     void build(std::span<const int> data, size_t& pos, size_t block = 0) {
         if (block < _nblocks) {
@@ -67,13 +137,7 @@ private:
         return child_block + offset;
     }
 
-    // NOTE: This is difficult to make dynamic due to the interaction with lane width.
-    // constants::block_len is more for readability, once changed, this will need updating.
-    static_assert(constants::block_len == 16);
-    int first_ge(int target, int* block) const noexcept {
-        __m512i target_vec = _mm512_set1_epi32(target);
-        __m512i data = _mm512_load_si512(reinterpret_cast<__m512i*>(block));
-        __mmask16 mask = _mm512_cmpge_epi32_mask(data, target_vec);
-        return __tzcnt_u16(mask);
-    }
+    // The node search kernels are shared with the B+ trees, which is only valid while our blocks
+    // are the same shape as theirs.
+    static_assert(constants::block_len == node<int>::block_len);
 };
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <immintrin.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "common.hpp"
+#include "isa.hpp"
+#include "node.hpp"
+
+// runtime_bplus with a smaller leaf layer. Wherever 32 consecutive keys (or at least 17 of them)
+// span less than 2^16, their leaf block packs them as 16-bit offsets from the block's first key,
+// so one cache line holds twice as many keys. Blocks that don't fit keep the raw 16 keys.
+//
+// The first key of a block, its base, isn't stored in a packed block. Instead the layer above the
+// leaves is the array of every leaf's base, 16 to a node, so the last node a lookup searches gives
+// it the base of the leaf it takes and the base of the leaf after, which is the answer if the
+// target is past every key in the leaf. Above that the layers are as in runtime_bplus, with a
+// separator per node of the layer below rather than per 16 keys, so they shrink with the leaves.
+//
+// A raw block stores its base as its first key, and a packed block stores offset 0 there, so a
+// block is raw exactly when its first 32 bits equal its base. The build keeps the one ambiguous
+// case, a packed block whose first two offsets read as the base, raw.
+//
+// Only lower_bound() is supported: ranks would need a count per block.
+class compressed_bplus {
+public:
+    using key_type = int;
+
+    compressed_bplus(std::span<const int> data) : _n(data.size()) {
+        std::vector<int> bases = plan(data);
+        allocate(bases.size());
+        build(data, bases);
+    }
+
+    ~compressed_bplus() {
+        std::free(_tree);
+    }
+
+    compressed_bplus(const compressed_bplus&) = delete;
+    compressed_bplus& operator=(const compressed_bplus&) = delete;
+
+    int lower_bound(int target) const noexcept {
+        return isa::dispatch([&](auto kernel) {
+            return dispatch_height([&]<int H>() {
+                size_t block = leaf_block<H>(kernel, target, descend<H>(kernel, target));
+                return search_leaf<H>(kernel, target, block);
+            });
+        });
+    }
+
+    // As lower_bound(), for B queries at a time, descending in lockstep and prefetching the next
+    // block of each query while the others are searched.
+    template <size_t B>
+    void lower_bound_batch(const int* queries, int* results) const noexcept {
+        isa::dispatch([&](auto kernel) {
+            dispatch_height([&]<int H>() { batch<B, H>(kernel, queries, results); });
+        });
+    }
+
+    size_t keys() const noexcept {
+        return _n;
+    }
+
+    size_t leaf_blocks() const noexcept {
+        return _leaf_blocks;
+    }
+
+    size_t packed_blocks() const noexcept {
+        return _packed_blocks;
+    }
+
+    // Every layer, padding included.
+    size_t bytes() const noexcept {
+        return _offsets[_num_layers] * sizeof(int);
+    }
+
+    int height() const noexcept {
+        return _num_layers;
+    }
+
+private:
+    static constexpr int block_len = node<int>::block_len;
+    static constexpr int packed_len = 2 * block_len;
+    static constexpr int max_key = node<int>::max_key;
+
+    // 32 keys per leaf, 16 leaves per base node and 17 children per node above reach over 10^10
+    // keys in 8 layers.
+    static constexpr int max_layers = 8;
+
+    int* _tree;
+    size_t _n;
+    size_t _leaf_blocks;
+    size_t _packed_blocks = 0;
+    int _first;  // the only base when there is a single leaf, and so no layer of bases
+    int _num_layers;
+    size_t _offsets[max_layers + 1];
+
+    // Splits the keys into leaf blocks, greedily packing as many as possible into each, and
+    // returns the base of every block.
+    static std::vector<int> plan(std::span<const int> data) {
+        std::vector<int> bases;
+        bases.reserve(data.size() / block_len + 1);
+
+        for (size_t i = 0; i < data.size(); i += block_keys(data, i)) {
+            bases.push_back(data[i]);
+        }
+        if (bases.empty()) {
+            bases.push_back(max_key);
+        }
+        return bases;
+    }
+
+    // The number of keys the leaf block starting at i takes: up to 32 if they pack, otherwise 16.
+    static size_t block_keys(std::span<const int> data, size_t i) {
+        size_t packed = packable(data, i);
+        return packed > 0 ? packed : std::min<size_t>(block_len, data.size() - i);
+    }
+
+    static size_t packable(std::span<const int> data, size_t i) {
+        size_t end = std::min<size_t>(i + packed_len, data.size());
+        int64_t limit = int64_t{data[i]} + UINT16_MAX;
+
+        size_t last = i;
+        while (last + 1 < end && data[last + 1] <= limit) {
+            last++;
+        }
+
+        size_t count = last - i + 1;
+        if (count <= static_cast<size_t>(block_len)) {
+            return 0;
+        }
+
+        // Offset 0 is always zero, so the first 32 bits are offset 1 shifted up.
+        auto second = static_cast<uint32_t>(data[i + 1] - data[i]);
+        return static_cast<int>(second << 16) == data[i] ? 0 : count;
+    }
+
+    void allocate(size_t leaf_blocks) {
+        _leaf_blocks = leaf_blocks;
+
+        // Layer 0 is the leaves, layer 1 their bases, 16 to a node, and each layer above that has
+        // a node per 17 nodes of the one below. The bases are followed by a block of max_key,
+        // which stands in for the base after the last leaf.
+        size_t nodes = leaf_blocks;
+        _offsets[0] = 0;
+        _num_layers = 0;
+        while (true) {
+            if (_num_layers == max_layers) {
+                throw std::length_error("compressed_bplus: too many keys");
+            }
+            size_t guard = _num_layers == 1 ? 1 : 0;
+            _offsets[_num_layers + 1] = _offsets[_num_layers] + (nodes + guard) * block_len;
+            _num_layers++;
+            if (nodes == 1) {
+                break;
+            }
+            size_t fanout = _num_layers == 1 ? block_len : block_len + 1;
+            nodes = (nodes + fanout - 1) / fanout;
+        }
+
+        size_t padded_bytes = (bytes() + constants::page_size - 1) / constants::page_size *
+                              constants::page_size;
+        _tree = static_cast<int*>(std::aligned_alloc(constants::page_size, padded_bytes));
+        madvise(_tree, padded_bytes, MADV_HUGEPAGE);
+    }
+
+    void build(std::span<const int> data, const std::vector<int>& bases) {
+        _first = bases.front();
+
+        size_t i = 0;
+        for (size_t block = 0; block < _leaf_blocks; block++) {
+            size_t packed = i < data.size() ? packable(data, i) : 0;
+            if (packed > 0) {
+                pack(data.subspan(i, packed), leaf(block));
+                _packed_blocks++;
+                i += packed;
+            } else {
+                size_t count = std::min<size_t>(block_len, data.size() - i);
+                int* keys = _tree + block * block_len;
+                std::copy_n(data.begin() + i, count, keys);
+                std::fill(keys + count, keys + block_len, count > 0 ? keys[count - 1] : max_key);
+                i += count;
+            }
+        }
+
+        if (_num_layers == 1) {
+            return;
+        }
+
+        std::fill(_tree + offset(1), _tree + offset(2), max_key);
+        std::copy(bases.begin(), bases.end(), _tree + offset(1));
+
+        // Separator k of a node is the first base under its child k + 1.
+        size_t stride = block_len;
+        for (int h = 2; h < _num_layers; h++) {
+            size_t children = (offset(h) - offset(h - 1)) / block_len - (h == 2 ? 1 : 0);
+            size_t layer_keys = offset(h + 1) - offset(h);
+
+            for (size_t k = 0; k < layer_keys; k++) {
+                size_t child = k / block_len * (block_len + 1) + k % block_len + 1;
+                _tree[offset(h) + k] = child < children ? bases[child * stride] : max_key;
+            }
+            stride *= block_len + 1;
+        }
+    }
+
+    // Padding repeats the last offset, so a target past it runs off the end of the block just as
+    // it would with the block full.
+    static void pack(std::span<const int> keys, uint16_t* deltas) {
+        for (size_t k = 0; k < static_cast<size_t>(packed_len); k++) {
+            deltas[k] = static_cast<uint16_t>(keys[std::min(k, keys.size() - 1)] - keys[0]);
+        }
+    }
+
+    size_t offset(int layer) const noexcept {
+        return _offsets[layer];
+    }
+
+    uint16_t* leaf(size_t block) const noexcept {
+        return reinterpret_cast<uint16_t*>(_tree + block * block_len);
+    }
+
+    // Declared before use would be enough in a template, but this class isn't one.
+    template <typename F>
+    auto dispatch_height(F&& f) const noexcept -> decltype(f.template operator()<1>()) {
+        switch (_num_layers) {
+        case 1:
+            return f.template operator()<1>();
+        case 2:
+            return f.template operator()<2>();
+        case 3:
+            return f.template operator()<3>();
+        case 4:
+            return f.template operator()<4>();
+        case 5:
+            return f.template operator()<5>();
+        case 6:
+            return f.template operator()<6>();
+        case 7:
+            return f.template operator()<7>();
+        default:
+            return f.template operator()<8>();
+        }
+    }
+
+    // The node of bases to search, walking the layers above it as runtime_bplus does.
+    template <int H, typename Isa>
+    size_t descend(Isa, int target) const noexcept {
+        size_t k = 0;
+        for (int h = H - 1; h > 1; h--) {
+            int i = Isa::first_ge(target, _tree + offset(h) + k * block_len);
+            k = k * (block_len + 1) + i;
+        }
+        return k;
+    }
+
+    // With base j the first not less than the target, the answer is in the leaf before j or is
+    // base j itself. Only the leftmost leaf is taken with j = 0, when the target is at most its
+    // base.
+    template <int H, typename Isa>
+    size_t leaf_block(Isa, int target, size_t k) const noexcept {
+        if constexpr (H == 1) {
+            return 0;
+        } else {
+            int j = Isa::first_ge(target, _tree + offset(1) + k * block_len);
+            return k * block_len + j - (j > 0);
+        }
+    }
+
+    template <int H, typename Isa>
+    int search_leaf(Isa, int target, size_t block) const noexcept {
+        const int* bases = _tree + offset(1);
+        int base = H > 1 ? bases[block] : _first;
+        int next_base = H > 1 ? bases[block + 1] : max_key;
+
+        const int* keys = _tree + block * block_len;
+        int first_word;
+        std::memcpy(&first_word, keys, sizeof(first_word));
+        if (first_word == base) {
+            int i = Isa::first_ge(target, keys);
+            return select(i < block_len, keys[i], next_base);
+        }
+
+        const uint16_t* deltas = leaf(block);
+        int i = Isa::first_ge_packed(target, base, deltas);
+        return select(i < packed_len, base + deltas[i], next_base);
+    }
+
+    // Reads past the end of a leaf land in the next block, so they are made unconditionally, but
+    // GCC still turns a ternary on them into a branch, which mispredicts whenever a target is past
+    // every key in its leaf.
+    static int select(bool condition, int if_true, int if_false) noexcept {
+        int mask = -static_cast<int>(condition);
+        return (if_true & mask) | (if_false & ~mask);
+    }
+
+    template <size_t B, int H, typename Isa>
+    void batch(Isa kernel, const int* queries, int* results) const noexcept {
+        size_t positions[B];
+        for (size_t i = 0; i < B; i++) {
+            positions[i] = 0;
+        }
+
+        // Down to the bases, and then one more pass to the leaves, each pass prefetching the
+        // block every query will search in the next.
+        for (int h = H - 1; h > 0; h--) {
+            for (size_t i = 0; i < B; i++) {
+                size_t k = positions[i];
+                if (h > 1) {
+                    int key_i = Isa::first_ge(queries[i], _tree + offset(h) + k * block_len);
+                    positions[i] = k * (block_len + 1) + key_i;
+                } else {
+                    positions[i] = leaf_block<H>(kernel, queries[i], k);
+                }
+
+                const int* next_block = _tree + offset(h - 1) + positions[i] * block_len;
+                _mm_prefetch(reinterpret_cast<const char*>(next_block), _MM_HINT_T0);
+            }
+        }
+
+        for (size_t i = 0; i < B; i++) {
+            results[i] = search_leaf<H>(kernel, queries[i], positions[i]);
+        }
+    }
+};
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "node.hpp"
+#include "runtime_bplus.hpp"
+
+// A sorted set of keys held as a run of sorted chunks of at most chunk_keys keys each, so that an
+// insert or erase moves the keys of one chunk rather than of the whole set.
+template <typename T>
+class sorted_chunks {
+public:
+    static constexpr size_t chunk_keys = 512;
+
+    size_t size() const noexcept {
+        return _size;
+    }
+
+    // The smallest key not less than key, or nullptr if there is none.
+    const T* lower_bound(T key) const noexcept {
+        size_t i = find_chunk(key);
+        if (i == _chunks.size()) {
+            return nullptr;
+        }
+        return &*std::lower_bound(_chunks[i].begin(), _chunks[i].end(), key);
+    }
+
+    bool contains(T key) const noexcept {
+        const T* found = lower_bound(key);
+        return found != nullptr && !(key < *found);
+    }
+
+    // Adds key, returning false if it was already present.
+    bool insert(T key) {
+        if (_chunks.empty()) {
+            _chunks.push_back({key});
+            _size++;
+            return true;
+        }
+
+        // Past the last key, the last chunk grows.
+        size_t i = std::min(find_chunk(key), _chunks.size() - 1);
+        std::vector<T>& chunk = _chunks[i];
+
+        auto at = std::lower_bound(chunk.begin(), chunk.end(), key);
+        if (at != chunk.end() && !(key < *at)) {
+            return false;
+        }
+        chunk.insert(at, key);
+        _size++;
+
+        if (chunk.size() > chunk_keys) {
+            std::vector<T> upper(chunk.begin() + chunk.size() / 2, chunk.end());
+            chunk.resize(chunk.size() / 2);
+            _chunks.insert(_chunks.begin() + i + 1, std::move(upper));
+        }
+        return true;
+    }
+
+    // Removes key, returning false if it was not present.
+    bool erase(T key) {
+        size_t i = find_chunk(key);
+        if (i == _chunks.size()) {
+            return false;
+        }
+
+        std::vector<T>& chunk = _chunks[i];
+        auto at = std::lower_bound(chunk.begin(), chunk.end(), key);
+        if (key < *at) {
+            return false;
+        }
+        chunk.erase(at);
+        _size--;
+
+        if (chunk.empty()) {
+            _chunks.erase(_chunks.begin() + i);
+        }
+        return true;
+    }
+
+    // Every key, in order.
+    std::vector<T> keys() const {
+        std::vector<T> all;
+        all.reserve(_size);
+        for (const std::vector<T>& chunk : _chunks) {
+            all.insert(all.end(), chunk.begin(), chunk.end());
+        }
+        return all;
+    }
+
+    // Replaces the contents with sorted, distinct keys.
+    void assign(std::span<const T> keys) {
+        _chunks.clear();
+        for (size_t first = 0; first < keys.size(); first += chunk_keys / 2) {
+            size_t count = std::min(chunk_keys / 2, keys.size() - first);
+            _chunks.emplace_back(keys.begin() + first, keys.begin() + first + count);
+        }
+        _size = keys.size();
+    }
+
+    void clear() noexcept {
+        _chunks.clear();
+        _size = 0;
+    }
+
+private:
+    std::vector<std::vector<T>> _chunks;  // none empty, each sorted, all in order
+    size_t _size = 0;
+
+    // The index of the first chunk whose last key is not less than key, or the number of chunks.
+    size_t find_chunk(T key) const noexcept {
+        auto chunk = std::partition_point(_chunks.begin(), _chunks.end(),
+                                          [&](const std::vector<T>& c) { return c.back() < key; });
+        return chunk - _chunks.begin();
+    }
+};
+
+// An updatable set of keys on top of an immutable runtime_bplus. Writes go into a small sorted
+// delta: inserted keys the base doesn't hold, and tombstones for base keys that have been erased.
+// Lookups search the base with SIMD as usual, step over tombstoned keys, and take the smaller of
+// that and the first inserted key. Both halves of the delta are sorted_chunks, so a write costs
+// about the same however large the delta has grown.
+//
+// Once the delta reaches merge_threshold entries, a write starts building a new base with a copy
+// of the delta applied on a background thread, and returns. Writes and lookups carry on against
+// the old base meanwhile, and the first write after the build has finished swaps the new base in,
+// keeping only the part of the delta written since the copy. merge() does the same on request,
+// waiting for the new base. A tree is not thread safe: lookups and writes must not overlap.
+//
+// Invariants: inserts and tombstones are disjoint, no insert is in the base, and every tombstone
+// is. Erasing a key removes all of its occurrences in the base.
+template <typename T = int>
+class delta_bplus {
+public:
+    using key_type = T;
+
+    static constexpr size_t default_merge_threshold = 1 << 16;
+
+    delta_bplus(std::span<const T> data, size_t merge_threshold = default_merge_threshold)
+        : _base(std::make_unique<runtime_bplus<T>>(data)), _merge_threshold(merge_threshold) {}
+
+    void insert(T key) {
+        if (!_erased.erase(key) && !in_base(key)) {
+            _inserts.insert(key);
+        }
+        maybe_merge();
+    }
+
+    void erase(T key) {
+        if (!_inserts.erase(key) && in_base(key)) {
+            _erased.insert(key);
+        }
+        maybe_merge();
+    }
+
+    // The smallest live key not less than target, or node<T>::max_key if there is none.
+    // Always by rank, even with an empty delta: the base's own lower_bound() past its last key
+    // reads whatever follows the leaves rather than max_key.
+    T lower_bound(T target) const noexcept {
+        return with_inserts(target, next_live(_base->lower_bound_rank(target)));
+    }
+
+    template <size_t B>
+    void lower_bound_batch(const T* queries, T* results) const noexcept {
+        size_t ranks[B];
+        _base->template lower_bound_rank_batch<B>(queries, ranks);
+
+        for (size_t i = 0; i < B; i++) {
+            results[i] = with_inserts(queries[i], next_live(ranks[i]));
+        }
+    }
+
+    // Rebuilds the base with the delta applied, and empties the delta. Duplicates in the original
+    // input are collapsed here too. Waits for a background merge in progress first.
+    void merge() {
+        if (_pending != nullptr) {
+            finish_merge();
+        }
+        if (delta_size() == 0) {
+            return;
+        }
+
+        _base = merged_base(*_base, _inserts.keys(), _erased.keys());
+        _inserts.clear();
+        _erased.clear();
+    }
+
+    // Whether a new base is being built in the background.
+    bool merging() const noexcept {
+        return _pending != nullptr;
+    }
+
+    // Inserts and tombstones not yet merged into the base.
+    size_t delta_size() const noexcept {
+        return _inserts.size() + _erased.size();
+    }
+
+    const runtime_bplus<T>& base() const noexcept {
+        return *_base;
+    }
+
+private:
+    // A base being built from a copy of the delta, which is kept to tell what was written since.
+    struct pending_merge {
+        std::vector<T> inserts;
+        std::vector<T> erased;
+        std::future<std::unique_ptr<runtime_bplus<T>>> base;
+    };
+
+    std::unique_ptr<runtime_bplus<T>> _base;
+    sorted_chunks<T> _inserts;
+    sorted_chunks<T> _erased;
+    size_t _merge_threshold;
+    // Last, so that it is destroyed first: the build reads the current base.
+    std::unique_ptr<pending_merge> _pending;
+
+    bool in_base(T key) const noexcept {
+        size_t rank = _base->lower_bound_rank(key);
+        return rank < _base->keys() && !(key < _base->leaves()[rank]);
+    }
+
+    // Swaps in a finished background merge, then starts one if the delta has reached the threshold.
+    void maybe_merge() {
+        if (_pending != nullptr &&
+            _pending->base.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            finish_merge();
+        }
+
+        if (_pending == nullptr && delta_size() >= _merge_threshold) {
+            _pending = std::make_unique<pending_merge>();
+            _pending->inserts = _inserts.keys();
+            _pending->erased = _erased.keys();
+            _pending->base = std::async(
+                std::launch::async, [base = _base.get(), pending = _pending.get()] {
+                    return merged_base(*base, pending->inserts, pending->erased);
+                });
+        }
+    }
+
+    // Waits for the background merge and swaps its base in. The delta is rewritten against the new
+    // base, which already holds the copy the merge started from.
+    void finish_merge() {
+        std::unique_ptr<runtime_bplus<T>> merged = _pending->base.get();
+        const std::vector<T>& copied_inserts = _pending->inserts;
+        const std::vector<T>& copied_erased = _pending->erased;
+        std::vector<T> inserts_now = _inserts.keys();
+        std::vector<T> erased_now = _erased.keys();
+
+        // Still inserted and not merged, or merged as erased but inserted again since.
+        std::vector<T> new_inserts, reinserted;
+        std::ranges::set_difference(inserts_now, copied_inserts, std::back_inserter(new_inserts));
+        std::ranges::set_difference(copied_erased, erased_now, std::back_inserter(reinserted));
+        std::vector<T> inserts;
+        std::ranges::merge(new_inserts, reinserted, std::back_inserter(inserts));
+
+        // Still erased and not merged, or merged as inserted but erased again since.
+        std::vector<T> new_erased, reerased;
+        std::ranges::set_difference(erased_now, copied_erased, std::back_inserter(new_erased));
+        std::ranges::set_difference(copied_inserts, inserts_now, std::back_inserter(reerased));
+        std::vector<T> erased;
+        std::ranges::merge(new_erased, reerased, std::back_inserter(erased));
+
+        _base = std::move(merged);
+        _inserts.assign(inserts);
+        _erased.assign(erased);
+        _pending.reset();
+    }
+
+    // A base holding the keys of base with inserts added and erased removed, all sorted.
+    static std::unique_ptr<runtime_bplus<T>> merged_base(const runtime_bplus<T>& base,
+                                                         std::span<const T> inserts,
+                                                         std::span<const T> erased) {
+        std::span<const T> leaves = base.leaves();
+
+        std::vector<T> merged;
+        merged.reserve(leaves.size() + inserts.size());
+
+        auto inserted = inserts.begin();
+        auto tombstone = erased.begin();
+        for (T key : leaves) {
+            while (inserted != inserts.end() && *inserted < key) {
+                merged.push_back(*inserted++);
+            }
+            while (tombstone != erased.end() && *tombstone < key) {
+                tombstone++;
+            }
+            bool live = tombstone == erased.end() || key < *tombstone;
+            if (live && (merged.empty() || merged.back() < key)) {
+                merged.push_back(key);
+            }
+        }
+        merged.insert(merged.end(), inserted, inserts.end());
+
+        return std::make_unique<runtime_bplus<T>>(merged);
+    }
+
+    // The first base key at or after rank which has not been erased, or max_key.
+    T next_live(size_t rank) const noexcept {
+        std::span<const T> leaves = _base->leaves();
+        for (; rank < leaves.size(); rank++) {
+            if (!_erased.contains(leaves[rank])) {
+                return leaves[rank];
+            }
+        }
+        return node<T>::max_key;
+    }
+
+    T with_inserts(T target, T base_key) const noexcept {
+        const T* inserted = _inserts.lower_bound(target);
+        if (inserted != nullptr && *inserted < base_key) {
+            return *inserted;
+        }
+        return base_key;
+    }
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+
+#include "node.hpp"
+
+// Runtime selection between the node search kernels in node.hpp, so one binary runs on hosts with
+// and without AVX-512.
+//
+// Dispatching per node would cost an indirect call in the innermost loop. Instead each tree hands
+// its whole lookup to dispatch() as a generic lambda taking the kernel. run_avx512() and friends are
+// compiled for their target and flattened, so the lookup and its kernel are inlined into one
+// function per instruction set, and we pay a single well predicted switch per call.
+namespace isa {
+
+enum class level { scalar, avx2, avx512 };
+
+inline level detect() noexcept {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("bmi")) {
+        return level::avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return level::avx2;
+    }
+    return level::scalar;
+}
+
+inline const char* name(level l) noexcept {
+    switch (l) {
+    case level::avx512:
+        return avx512::name;
+    case level::avx2:
+        return avx2::name;
+    default:
+        return scalar::name;
+    }
+}
+
+// The best kernel this host supports.
+inline const level supported = detect();
+
+inline std::atomic<level> active_level = supported;
+
+inline level active() noexcept {
+    return active_level.load(std::memory_order_relaxed);
+}
+
+// Use the given kernel for all subsequent lookups, e.g. to compare them side by side. Returns false,
+// leaving the selection unchanged, if this host can't run it.
+inline bool select(level l) noexcept {
+    if (l > supported) {
+        return false;
+    }
+
+    active_level.store(l, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename F>
+[[gnu::target("avx512f,bmi"), gnu::flatten]] auto run_avx512(F&& f) {
+    return f(avx512{});
+}
+
+template <typename F>
+[[gnu::target("avx2,popcnt"), gnu::flatten]] auto run_avx2(F&& f) {
+    return f(avx2{});
+}
+
+template <typename F>
+[[gnu::flatten]] auto run_scalar(F&& f) {
+    return f(scalar{});
+}
+
+template <typename F>
+auto dispatch(F&& f) {
+    switch (active()) {
+    case level::avx512:
+        return run_avx512(f);
+    case level::avx2:
+        return run_avx2(f);
+    default:
+        return run_scalar(f);
+    }
+}
+
+}  // namespace isa
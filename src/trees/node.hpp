@@ -0,0 +1,369 @@
+#pragma once
+
+#include <immintrin.h>
+
+#include <cstdint>
+#include <limits>
+
+// A node is one 64 byte cache line of keys. The number of keys in a node therefore depends on the
+// key width: 16 for 32-bit keys, 8 for 64-bit keys. Unused slots are padded with max_key, which
+// compares not less than every target.
+template <typename T>
+struct node;
+
+template <>
+struct node<int32_t> {
+    static constexpr int block_len = 16;
+    static constexpr int32_t max_key = std::numeric_limits<int32_t>::max();
+};
+
+template <>
+struct node<uint32_t> {
+    static constexpr int block_len = 16;
+    static constexpr uint32_t max_key = std::numeric_limits<uint32_t>::max();
+};
+
+template <>
+struct node<int64_t> {
+    static constexpr int block_len = 8;
+    static constexpr int64_t max_key = std::numeric_limits<int64_t>::max();
+};
+
+template <>
+struct node<uint64_t> {
+    static constexpr int block_len = 8;
+    static constexpr uint64_t max_key = std::numeric_limits<uint64_t>::max();
+};
+
+template <>
+struct node<float> {
+    static constexpr int block_len = 16;
+    static constexpr float max_key = std::numeric_limits<float>::infinity();
+};
+
+template <>
+struct node<double> {
+    static constexpr int block_len = 8;
+    static constexpr double max_key = std::numeric_limits<double>::infinity();
+};
+
+// The node search kernels, one struct per instruction set. first_ge() returns the index of the
+// first key in the block which is not less than the target, or block_len if there is none.
+//
+// Each kernel is compiled for its own target, so nothing here needs -mavx512f. They are only fast
+// once inlined into a caller built for the same target; see isa::dispatch().
+namespace isa {
+
+// Compare !(key < target) across the whole block simultaneously. The number of results for which
+// this is false (counted by tzcnt) is the index of the lower bound. Using !(key < target) rather
+// than key >= target makes floats, NaN targets included, order exactly as std::lower_bound does.
+struct avx512 {
+    static constexpr const char* name = "avx512";
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge(int32_t target, const int32_t* block) noexcept {
+        __m512i data = _mm512_load_si512(block);
+        return __tzcnt_u16(_mm512_cmpge_epi32_mask(data, _mm512_set1_epi32(target)));
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge(uint32_t target, const uint32_t* block) noexcept {
+        __m512i data = _mm512_load_si512(block);
+        __m512i target_vec = _mm512_set1_epi32(static_cast<int>(target));
+        return __tzcnt_u16(_mm512_cmpge_epu32_mask(data, target_vec));
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge(int64_t target, const int64_t* block) noexcept {
+        __m512i data = _mm512_load_si512(block);
+        return first_set_8(_mm512_cmpge_epi64_mask(data, _mm512_set1_epi64(target)));
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge(uint64_t target, const uint64_t* block) noexcept {
+        __m512i data = _mm512_load_si512(block);
+        __m512i target_vec = _mm512_set1_epi64(static_cast<long long>(target));
+        return first_set_8(_mm512_cmpge_epu64_mask(data, target_vec));
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge(float target, const float* block) noexcept {
+        __m512 data = _mm512_load_ps(block);
+        return __tzcnt_u16(_mm512_cmp_ps_mask(data, _mm512_set1_ps(target), _CMP_NLT_UQ));
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge(double target, const double* block) noexcept {
+        __m512d data = _mm512_load_pd(block);
+        return first_set_8(_mm512_cmp_pd_mask(data, _mm512_set1_pd(target), _CMP_NLT_UQ));
+    }
+
+    // A packed leaf: 32 keys stored as 16-bit offsets from base. Each half widens to 16 lanes and
+    // is rebased before the usual compare. Returns 32 if no key is not less than the target.
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge_packed(int32_t target, int32_t base, const uint16_t* block) noexcept {
+        __m512i base_vec = _mm512_set1_epi32(base);
+        __m512i target_vec = _mm512_set1_epi32(target);
+        __m512i lo = _mm512_add_epi32(widen_half(block), base_vec);
+        __m512i hi = _mm512_add_epi32(widen_half(block + 16), base_vec);
+        uint32_t lo_mask = _mm512_cmpge_epi32_mask(lo, target_vec);
+        uint32_t hi_mask = _mm512_cmpge_epi32_mask(hi, target_vec);
+        return __tzcnt_u32(lo_mask | (hi_mask << 16));
+    }
+
+    // Half a line: the first 32 bytes, loaded and compared under a mask, as AVX-512F alone has no
+    // 256-bit compare into a mask register. Masked out lanes are never read.
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge_half(int32_t target, const int32_t* half) noexcept {
+        __m512i data = _mm512_maskz_loadu_epi32(0xff, half);
+        return first_set(_mm512_mask_cmpge_epi32_mask(0xff, data, _mm512_set1_epi32(target)), 8);
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge_half(uint32_t target, const uint32_t* half) noexcept {
+        __m512i data = _mm512_maskz_loadu_epi32(0xff, half);
+        __m512i target_vec = _mm512_set1_epi32(static_cast<int>(target));
+        return first_set(_mm512_mask_cmpge_epu32_mask(0xff, data, target_vec), 8);
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge_half(int64_t target, const int64_t* half) noexcept {
+        __m512i data = _mm512_maskz_loadu_epi64(0xf, half);
+        return first_set(_mm512_mask_cmpge_epi64_mask(0xf, data, _mm512_set1_epi64(target)), 4);
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge_half(uint64_t target, const uint64_t* half) noexcept {
+        __m512i data = _mm512_maskz_loadu_epi64(0xf, half);
+        __m512i target_vec = _mm512_set1_epi64(static_cast<long long>(target));
+        return first_set(_mm512_mask_cmpge_epu64_mask(0xf, data, target_vec), 4);
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge_half(float target, const float* half) noexcept {
+        __m512 data = _mm512_maskz_loadu_ps(0xff, half);
+        __m512 target_vec = _mm512_set1_ps(target);
+        return first_set(_mm512_mask_cmp_ps_mask(0xff, data, target_vec, _CMP_NLT_UQ), 8);
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static int first_ge_half(double target, const double* half) noexcept {
+        __m512d data = _mm512_maskz_loadu_pd(0xf, half);
+        __m512d target_vec = _mm512_set1_pd(target);
+        return first_set(_mm512_mask_cmp_pd_mask(0xf, data, target_vec, _CMP_NLT_UQ), 4);
+    }
+
+private:
+    // Masked, as GCC 12 warns that the plain widening's undefined passthrough is uninitialised.
+    [[gnu::target("avx512f,bmi")]]
+    static __m512i widen_half(const uint16_t* half) noexcept {
+        __m256i deltas = _mm256_load_si256(reinterpret_cast<const __m256i*>(half));
+        return _mm512_maskz_cvtepu16_epi32(0xffff, deltas);
+    }
+
+    // An 8-bit mask zero extends, so tzcnt would give 16 for 'not found' rather than 8.
+    [[gnu::target("avx512f,bmi")]]
+    static int first_set_8(__mmask8 mask) noexcept {
+        return __tzcnt_u32(mask | (1u << 8));
+    }
+
+    // The same for a mask over fewer lanes.
+    [[gnu::target("avx512f,bmi")]]
+    static int first_set(uint32_t mask, int lanes) noexcept {
+        return __tzcnt_u32(mask | (1u << lanes));
+    }
+};
+
+// Two 32 byte halves. Blocks are sorted, so rather than finding the first key not less than the
+// target we can count the keys which are less than it: a compare, movemask and popcnt per half.
+struct avx2 {
+    static constexpr const char* name = "avx2";
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge(int32_t target, const int32_t* block) noexcept {
+        __m256i target_vec = _mm256_set1_epi32(target);
+        __m256i lo = _mm256_cmpgt_epi32(target_vec, load(block));
+        __m256i hi = _mm256_cmpgt_epi32(target_vec, load(block + 8));
+        return count_32(lo, hi);
+    }
+
+    // There is no unsigned compare, so flip the sign bits and compare signed.
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge(uint32_t target, const uint32_t* block) noexcept {
+        __m256i sign = _mm256_set1_epi32(INT32_MIN);
+        __m256i target_vec = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(target)), sign);
+        __m256i lo = _mm256_cmpgt_epi32(target_vec, _mm256_xor_si256(load(block), sign));
+        __m256i hi = _mm256_cmpgt_epi32(target_vec, _mm256_xor_si256(load(block + 8), sign));
+        return count_32(lo, hi);
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge(int64_t target, const int64_t* block) noexcept {
+        __m256i target_vec = _mm256_set1_epi64x(target);
+        __m256i lo = _mm256_cmpgt_epi64(target_vec, load(block));
+        __m256i hi = _mm256_cmpgt_epi64(target_vec, load(block + 4));
+        return count_64(lo, hi);
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge(uint64_t target, const uint64_t* block) noexcept {
+        __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+        __m256i target_vec =
+            _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(target)), sign);
+        __m256i lo = _mm256_cmpgt_epi64(target_vec, _mm256_xor_si256(load(block), sign));
+        __m256i hi = _mm256_cmpgt_epi64(target_vec, _mm256_xor_si256(load(block + 4), sign));
+        return count_64(lo, hi);
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge(float target, const float* block) noexcept {
+        __m256 target_vec = _mm256_set1_ps(target);
+        __m256 lo = _mm256_cmp_ps(_mm256_load_ps(block), target_vec, _CMP_LT_OQ);
+        __m256 hi = _mm256_cmp_ps(_mm256_load_ps(block + 8), target_vec, _CMP_LT_OQ);
+        return _mm_popcnt_u32(_mm256_movemask_ps(lo) | (_mm256_movemask_ps(hi) << 8));
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge(double target, const double* block) noexcept {
+        __m256d target_vec = _mm256_set1_pd(target);
+        __m256d lo = _mm256_cmp_pd(_mm256_load_pd(block), target_vec, _CMP_LT_OQ);
+        __m256d hi = _mm256_cmp_pd(_mm256_load_pd(block + 4), target_vec, _CMP_LT_OQ);
+        return _mm_popcnt_u32(_mm256_movemask_pd(lo) | (_mm256_movemask_pd(hi) << 4));
+    }
+
+    // A packed leaf, widened and rebased a quarter at a time.
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge_packed(int32_t target, int32_t base, const uint16_t* block) noexcept {
+        __m256i base_vec = _mm256_set1_epi32(base);
+        __m256i target_vec = _mm256_set1_epi32(target);
+
+        uint32_t less = 0;
+        for (int quarter = 0; quarter < 4; quarter++) {
+            __m128i deltas = _mm_load_si128(reinterpret_cast<const __m128i*>(block + quarter * 8));
+            __m256i keys = _mm256_add_epi32(_mm256_cvtepu16_epi32(deltas), base_vec);
+            __m256i mask = _mm256_cmpgt_epi32(target_vec, keys);
+            less |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(mask)))
+                    << (quarter * 8);
+        }
+        return _mm_popcnt_u32(less);
+    }
+
+    // Half a line is one register: a single compare, movemask and popcnt.
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge_half(int32_t target, const int32_t* half) noexcept {
+        __m256i less = _mm256_cmpgt_epi32(_mm256_set1_epi32(target), load(half));
+        return _mm_popcnt_u32(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge_half(uint32_t target, const uint32_t* half) noexcept {
+        __m256i sign = _mm256_set1_epi32(INT32_MIN);
+        __m256i target_vec = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(target)), sign);
+        __m256i less = _mm256_cmpgt_epi32(target_vec, _mm256_xor_si256(load(half), sign));
+        return _mm_popcnt_u32(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge_half(int64_t target, const int64_t* half) noexcept {
+        __m256i less = _mm256_cmpgt_epi64(_mm256_set1_epi64x(target), load(half));
+        return _mm_popcnt_u32(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge_half(uint64_t target, const uint64_t* half) noexcept {
+        __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+        __m256i target_vec =
+            _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(target)), sign);
+        __m256i less = _mm256_cmpgt_epi64(target_vec, _mm256_xor_si256(load(half), sign));
+        return _mm_popcnt_u32(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge_half(float target, const float* half) noexcept {
+        __m256 less = _mm256_cmp_ps(_mm256_load_ps(half), _mm256_set1_ps(target), _CMP_LT_OQ);
+        return _mm_popcnt_u32(_mm256_movemask_ps(less));
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int first_ge_half(double target, const double* half) noexcept {
+        __m256d less = _mm256_cmp_pd(_mm256_load_pd(half), _mm256_set1_pd(target), _CMP_LT_OQ);
+        return _mm_popcnt_u32(_mm256_movemask_pd(less));
+    }
+
+private:
+    template <typename T>
+    [[gnu::target("avx2,popcnt")]]
+    static __m256i load(const T* half) noexcept {
+        return _mm256_load_si256(reinterpret_cast<const __m256i*>(half));
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int count_32(__m256i lo, __m256i hi) noexcept {
+        int lo_mask = _mm256_movemask_ps(_mm256_castsi256_ps(lo));
+        int hi_mask = _mm256_movemask_ps(_mm256_castsi256_ps(hi));
+        return _mm_popcnt_u32(lo_mask | (hi_mask << 8));
+    }
+
+    [[gnu::target("avx2,popcnt")]]
+    static int count_64(__m256i lo, __m256i hi) noexcept {
+        int lo_mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo));
+        int hi_mask = _mm256_movemask_pd(_mm256_castsi256_pd(hi));
+        return _mm_popcnt_u32(lo_mask | (hi_mask << 4));
+    }
+};
+
+// Portable fallback. Counting rather than searching keeps it branchless, and leaves the compiler
+// free to vectorise it with whatever the baseline target offers.
+struct scalar {
+    static constexpr const char* name = "scalar";
+
+    template <typename T>
+    static int first_ge(T target, const T* block) noexcept {
+        int count = 0;
+        for (int i = 0; i < node<T>::block_len; i++) {
+            count += block[i] < target;
+        }
+        return count;
+    }
+
+    static int first_ge_packed(int32_t target, int32_t base, const uint16_t* block) noexcept {
+        int count = 0;
+        for (int i = 0; i < 32; i++) {
+            count += base + block[i] < target;
+        }
+        return count;
+    }
+
+    template <typename T>
+    static int first_ge_half(T target, const T* half) noexcept {
+        int count = 0;
+        for (int i = 0; i < node<T>::block_len / 2; i++) {
+            count += half[i] < target;
+        }
+        return count;
+    }
+};
+
+// first_ge() over a node of Width keys, for trees whose nodes are not exactly one cache line. A
+// wider node is searched a line at a time: each line's kernel returns its count of keys less than
+// the target, and as the node is sorted, their sum is the index. The lines are independent, so
+// their compares overlap. A node of half a line has its own kernel, first_ge_half().
+template <int Width, typename Isa, typename T>
+inline int first_ge_n(Isa, T target, const T* block) noexcept {
+    constexpr int line = node<T>::block_len;
+    static_assert(Width % line == 0 || Width * 2 == line);
+
+    if constexpr (Width == line) {
+        return Isa::first_ge(target, block);
+    } else if constexpr (Width < line) {
+        return Isa::first_ge_half(target, block);
+    } else {
+        int count = 0;
+        for (int i = 0; i < Width; i += line) {
+            count += Isa::first_ge(target, block + i);
+        }
+        return count;
+    }
+}
+
+}  // namespace isa
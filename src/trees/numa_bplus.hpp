@@ -0,0 +1,74 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "numa.hpp"
+#include "runtime_bplus.hpp"
+
+// A runtime_bplus for machines with several NUMA nodes. With replicate, the tree is built once and
+// copied onto every node, and each lookup is routed to the copy on the node of the calling thread,
+// so leaf misses never cross the interconnect. With interleave, there is a single copy whose pages
+// are spread round robin across the nodes, which costs no extra memory and gives every thread the
+// same average latency rather than some threads all remote.
+//
+// The node is looked up once per call, so batches amortise it. A thread migrated mid-batch still
+// gets correct results, just from a remote replica.
+template <typename T = int>
+class numa_bplus {
+public:
+    using key_type = T;
+
+    enum mode { replicate, interleave };
+
+    numa_bplus(std::span<const T> data, mode m = replicate) {
+        if (m == interleave || numa::node_count() == 1) {
+            auto where = m == interleave ? numa::placement::interleaved() : numa::placement{};
+            _replicas.push_back(std::make_unique<runtime_bplus<T>>(data, where));
+            return;
+        }
+
+        _replicas.push_back(std::make_unique<runtime_bplus<T>>(data, numa::placement::on(0)));
+        for (int node = 1; node < numa::node_count(); node++) {
+            _replicas.push_back(
+                std::make_unique<runtime_bplus<T>>(*_replicas.front(), numa::placement::on(node)));
+        }
+    }
+
+    T lower_bound(T target) const noexcept {
+        return local().lower_bound(target);
+    }
+
+    template <size_t B>
+    void lower_bound_batch(const T* queries, T* results) const noexcept {
+        local().template lower_bound_batch<B>(queries, results);
+    }
+
+    template <size_t B>
+    void lower_bound_rank_batch(const T* queries, size_t* ranks) const noexcept {
+        local().template lower_bound_rank_batch<B>(queries, ranks);
+    }
+
+    // The copy lookups from the calling thread go to. With a single copy there is nothing to
+    // choose, so the node isn't looked up at all.
+    const runtime_bplus<T>& local() const noexcept {
+        if (_replicas.size() == 1) {
+            return *_replicas.front();
+        }
+        return replica(numa::current_node());
+    }
+
+    // The copy on the given node. Without replication every node shares the one copy.
+    const runtime_bplus<T>& replica(int node) const noexcept {
+        size_t index = static_cast<size_t>(node);
+        return *_replicas[index < _replicas.size() ? index : 0];
+    }
+
+    size_t replicas() const noexcept {
+        return _replicas.size();
+    }
+
+private:
+    std::vector<std::unique_ptr<runtime_bplus<T>>> _replicas;
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "runtime_bplus.hpp"
+
+// A B+ tree over byte string keys: URLs, symbols, or composite keys encoded with
+// big_endian_key(). The tree itself is a runtime_bplus over a fixed-width prefix of each key,
+// P = uint32_t or uint64_t, read big-endian and zero padded, so comparing prefixes as unsigned
+// integers orders them as the strings would. The descent is then the usual first_ge search over
+// 16 or 8 prefixes per node, and the full keys are only read at the end, from an arena alongside,
+// to break ties between keys that share a prefix.
+//
+// The bytes every key starts with (the "https://" of a set of URLs, say) would make every prefix
+// equal, so the prefixes are taken after the keys' longest common prefix instead.
+template <typename P = uint64_t>
+    requires std::same_as<P, uint32_t> || std::same_as<P, uint64_t>
+class prefix_bplus {
+public:
+    using key_type = std::string_view;
+
+    // keys must be sorted, and convertible to std::string_view.
+    template <typename Keys>
+    explicit prefix_bplus(const Keys& keys)
+        : _common(common_length(keys)), _tree(encode_all(keys, _common)) {
+        _offsets.reserve(std::size(keys) + 1);
+        _offsets.push_back(0);
+        for (std::string_view key : keys) {
+            _arena.insert(_arena.end(), key.begin(), key.end());
+            _offsets.push_back(_arena.size());
+        }
+    }
+
+    // The index of the first key not less than target, or keys() if there is none.
+    size_t lower_bound_rank(std::string_view target) const noexcept {
+        int side = outside(target);
+        if (side != 0) {
+            return side < 0 ? 0 : keys();
+        }
+
+        P prefix = encode(target.substr(_common));
+        return tie_break(target, prefix, _tree.lower_bound_rank(prefix));
+    }
+
+    // The first key not less than target, or an empty view if there is none.
+    std::string_view lower_bound(std::string_view target) const noexcept {
+        size_t rank = lower_bound_rank(target);
+        return rank < keys() ? key(rank) : std::string_view();
+    }
+
+    // As lower_bound_rank(), for B targets at a time, with the prefixes looked up by
+    // runtime_bplus::lower_bound_rank_batch().
+    template <size_t B>
+    void lower_bound_rank_batch(const std::string_view* targets, size_t* ranks) const noexcept {
+        P prefixes[B];
+        for (size_t i = 0; i < B; i++) {
+            prefixes[i] = outside(targets[i]) == 0 ? encode(targets[i].substr(_common)) : 0;
+        }
+
+        _tree.template lower_bound_rank_batch<B>(prefixes, ranks);
+
+        for (size_t i = 0; i < B; i++) {
+            int side = outside(targets[i]);
+            ranks[i] = side < 0   ? 0
+                       : side > 0 ? keys()
+                                  : tie_break(targets[i], prefixes[i], ranks[i]);
+        }
+    }
+
+    std::string_view key(size_t i) const noexcept {
+        return {_arena.data() + _offsets[i], _offsets[i + 1] - _offsets[i]};
+    }
+
+    size_t keys() const noexcept {
+        return _offsets.size() - 1;
+    }
+
+    // The prefix tree and the key arena.
+    size_t bytes() const noexcept {
+        return _tree.bytes() + _arena.size() + _offsets.size() * sizeof(size_t);
+    }
+
+    // The length of the prefix shared by every key, which the tree skips.
+    size_t common_prefix() const noexcept {
+        return _common;
+    }
+
+private:
+    size_t _common;
+    runtime_bplus<P> _tree;
+    std::vector<char> _arena;
+    std::vector<size_t> _offsets;  // key i is _arena[_offsets[i], _offsets[i + 1])
+
+    // The first sizeof(P) bytes of key as a big-endian integer, zero padded.
+    static P encode(std::string_view key) noexcept {
+        if (key.size() >= sizeof(P)) {
+            P raw;
+            std::memcpy(&raw, key.data(), sizeof(P));
+            return std::byteswap(raw);
+        }
+
+        P prefix = 0;
+        for (size_t i = 0; i < sizeof(P); i++) {
+            unsigned char byte = i < key.size() ? static_cast<unsigned char>(key[i]) : 0;
+            prefix = static_cast<P>(prefix << 8) | byte;
+        }
+        return prefix;
+    }
+
+    template <typename Keys>
+    static size_t common_length(const Keys& keys) {
+        if (std::size(keys) == 0) {
+            return 0;
+        }
+
+        // Sorted, so whatever the first and last keys share, everything between shares too.
+        std::string_view first = *std::begin(keys);
+        std::string_view last = *std::prev(std::end(keys));
+        return std::mismatch(first.begin(), first.end(), last.begin(), last.end()).first -
+               first.begin();
+    }
+
+    template <typename Keys>
+    static std::vector<P> encode_all(const Keys& keys, size_t common) {
+        std::vector<P> prefixes;
+        prefixes.reserve(std::size(keys));
+        for (std::string_view key : keys) {
+            prefixes.push_back(encode(key.substr(common)));
+        }
+        return prefixes;
+    }
+
+    // Where target falls against the common prefix: below every key (-1), above every key (1),
+    // or among them (0).
+    int outside(std::string_view target) const noexcept {
+        if (_common == 0) {
+            return 0;
+        }
+
+        std::string_view common = key(0).substr(0, _common);
+        int order = target.substr(0, _common).compare(common);
+        return order < 0 ? -1 : order > 0 ? 1 : 0;
+    }
+
+    // rank is the first key whose prefix is not below target's. Unless that prefix is equal, it
+    // is the answer; otherwise the answer is within the run of keys sharing the prefix, found by
+    // galloping to the end of the run and then binary searching it by full key.
+    size_t tie_break(std::string_view target, P prefix, size_t rank) const noexcept {
+        std::span<const P> prefixes = _tree.leaves();
+        if (rank == keys() || prefixes[rank] != prefix) {
+            return rank;
+        }
+
+        size_t end = rank + 1;
+        for (size_t step = 1; end < keys() && prefixes[end] == prefix; step *= 2) {
+            end = std::min(end + step, keys());
+        }
+        end = std::partition_point(prefixes.begin() + rank, prefixes.begin() + end,
+                                   [&](P p) { return p == prefix; }) -
+              prefixes.begin();
+
+        size_t first = rank;
+        size_t count = end - rank;
+        while (count > 0) {
+            size_t half = count / 2;
+            if (key(first + half) < target) {
+                first += half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+        return first;
+    }
+};
+
+// The integers as one key, each big-endian so the keys order as the tuples would: for example
+// big_endian_key(tenant_id, timestamp) for a (tenant_id, ts) index. Signed values are offset so
+// that negative ones order first.
+template <std::integral... Ts>
+inline std::string big_endian_key(Ts... fields) {
+    std::string key;
+    key.reserve((sizeof(Ts) + ...));
+
+    auto append = [&]<typename T>(T field) {
+        using U = std::make_unsigned_t<T>;
+        U bits = static_cast<U>(field);
+        if constexpr (std::is_signed_v<T>) {
+            bits ^= U{1} << (sizeof(T) * 8 - 1);
+        }
+        for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+            key.push_back(static_cast<char>((bits >> shift) & 0xff));
+        }
+    };
+    (append(fields), ...);
+    return key;
+}
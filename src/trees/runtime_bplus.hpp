@@ -0,0 +1,1270 @@
+#pragma once
+
+#include <fcntl.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+#include "huge_pages.hpp"
+#include "isa.hpp"
+#include "node.hpp"
+#include "numa.hpp"
+#include "thread_pool.hpp"
+#include "tree_arena.hpp"
+
+// The same layout as bplus<N>, but with the number of keys only known at runtime. The layer
+// offsets and height are computed once in the constructor. To keep the descent as tight as the
+// constexpr version, lookups switch on the height once and then run a traversal instantiated for
+// that height, so the per-layer loop is still fully unrolled.
+//
+// An optional payload of type V (row IDs, offsets into a column file, ...) can be stored alongside
+// the keys. It lives in the same allocation, directly after the last layer, indexed by rank.
+//
+// save() writes that allocation to a file behind a small header, and open() maps it back as is, so
+// a large tree can be reopened without reading its input or rebuilding the internal layers.
+//
+// Lookups reach each layer through _layers rather than _tree + offset(h), so the internal layers
+// can be read from a copy elsewhere; see cache_inner_layers().
+template <typename T = int, typename V = void>
+class runtime_bplus {
+private:
+    static_assert(std::is_void_v<V> || std::is_trivially_copyable_v<V>);
+
+    static constexpr int block_len = node<T>::block_len;
+
+    // Even with 8 keys per node, 8 * 9^11 keys is far more than will fit in memory.
+    static constexpr int max_layers = 12;
+
+    static constexpr size_t block_count(size_t num_keys) {
+        // block_count = ceil(num_keys / block_length)
+        return (num_keys + (block_len - 1)) / block_len;
+    }
+
+    static constexpr size_t parent_layer_keys(size_t num_keys) {
+        // parent_size = ceil(blocks_on_layer / children_per_block) * block_len
+        return (block_count(num_keys) + block_len) / (block_len + 1) *
+               block_len;
+    }
+
+public:
+    using key_type = T;
+
+    runtime_bplus(std::span<const T> data) : _n(data.size()) {
+        allocate(0);
+        build(data);
+    }
+
+    // Copies the input and fills the internal layers across the threads of pool.
+    runtime_bplus(std::span<const T> data, thread_pool& pool) : _n(data.size()) {
+        allocate(0);
+        build(data, &pool);
+    }
+
+    // Places the tree's pages before the build first touches them, for example on one NUMA node or
+    // interleaved across all of them.
+    runtime_bplus(std::span<const T> data, numa::placement where) : _n(data.size()) {
+        allocate(0, where);
+        build(data);
+    }
+
+    // Builds into memory from arena, packed alongside the arena's other trees instead of in an
+    // allocation of its own. The arena must outlive the tree, and may not release the generation
+    // the tree was built in until it is destroyed.
+    runtime_bplus(std::span<const T> data, tree_arena& arena) : _n(data.size()) {
+        allocate(0, arena);
+        build(data);
+    }
+
+    // Copies other, values included, into memory with the given placement. Cheaper than building
+    // again, so it is how numa_bplus makes one replica per node.
+    runtime_bplus(const runtime_bplus& other, numa::placement where) : _n(other._n) {
+        allocate(other.payload_bytes(), where);
+        std::memcpy(_tree, other._tree, tree_bytes() + payload_bytes());
+    }
+
+    // Builds from n sorted keys without them ever being held elsewhere in full. read(chunk) is
+    // called with consecutive pieces of the leaf layer, in order, and must fill each with the next
+    // chunk.size() keys.
+    template <typename Read>
+        requires std::invocable<Read&, std::span<T>>
+    runtime_bplus(size_t n, Read&& read) : _n(n) {
+        allocate(0);
+        try {
+            build_streaming(read);
+        } catch (...) {
+            std::free(_tree);
+            throw;
+        }
+    }
+
+    // Builds from a file of sorted keys in native byte order, such as data/data.bin, reading it
+    // straight into the leaf layer. Throws std::runtime_error if the file is not a whole number of
+    // keys.
+    static runtime_bplus from_file(const char* path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error(std::string("runtime_bplus: failed to open ") + path);
+        }
+
+        size_t bytes = static_cast<size_t>(file.tellg());
+        if (bytes % sizeof(T) != 0) {
+            throw std::runtime_error(std::string("runtime_bplus: partial key at the end of ") +
+                                     path);
+        }
+        size_t n = bytes / sizeof(T);
+        file.seekg(0);
+
+        return runtime_bplus(n, [&](std::span<T> chunk) {
+            file.read(reinterpret_cast<char*>(chunk.data()), chunk.size_bytes());
+            if (!file) {
+                throw std::runtime_error(std::string("runtime_bplus: failed to read ") + path);
+            }
+        });
+    }
+
+    // values[i] is the payload of data[i]. Throws std::invalid_argument unless there is exactly
+    // one value per key.
+    runtime_bplus(std::span<const T> data, std::span<const V> values)
+        requires(!std::is_void_v<V>)
+        : _n(data.size()) {
+        if (values.size() != _n) {
+            throw std::invalid_argument("runtime_bplus: expected one value per key");
+        }
+
+        // One extra slot holds V{} so that a lower bound past the end needs no branch.
+        allocate((_n + 1) * sizeof(V));
+
+        std::uninitialized_copy_n(values.data(), _n, _values);
+        _values[_n] = V{};
+
+        build(data);
+    }
+
+    ~runtime_bplus() {
+        huge_pages::unmap(_inner);
+        if (_mapping != nullptr) {
+            munmap(_mapping, _mapped_bytes);
+        } else if (!_pooled) {
+            std::free(_tree);
+        }
+    }
+
+    runtime_bplus(const runtime_bplus&) = delete;
+    runtime_bplus& operator=(const runtime_bplus&) = delete;
+
+    struct open_options {
+        bool populate = false;   // MAP_POPULATE: read the whole file in now, not on first touch
+        bool huge_pages = true;  // MADV_HUGEPAGE, where the filesystem supports it
+    };
+
+    // Writes every layer, the padding and the payload, behind a header recording the layout.
+    // The file is in native byte order. It opens as a runtime_bplus with the same T and either the
+    // same V or none, in which case the payload is ignored. A file without a payload only opens
+    // with no V.
+    void save(const char* path) const {
+        char header[file_header_bytes] = {};
+        file_header fields = make_header();
+        std::memcpy(header, &fields, sizeof(fields));
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(header, file_header_bytes);
+        file.write(reinterpret_cast<const char*>(_tree), tree_bytes() + payload_bytes());
+        if (!file) {
+            throw std::runtime_error(std::string("runtime_bplus: failed to write ") + path);
+        }
+    }
+
+    // Maps a file written by save() read only. Nothing is copied or rebuilt: lookups read the page
+    // cache directly, so a cold open is a few system calls and the first queries fault in the
+    // pages they touch, unless options.populate asks for all of them up front.
+    static runtime_bplus open(const char* path, open_options options = {}) {
+        return runtime_bplus(path, options);
+    }
+
+    // Copies the internal layers, which every lookup reads, into a region of their own backed by
+    // explicit huge pages, so they no longer share pages or TLB entries with cold leaves. Only
+    // lookups read the copy; save() and copies still take the tree as built. Returns the page size
+    // obtained: 1GiB or 2MiB if the hugetlb pool had them, otherwise the base page size. Returns 0,
+    // and changes nothing, for a tree with no internal layers or if the mapping failed.
+    size_t cache_inner_layers(huge_pages::options options = {}) {
+        if (_num_layers == 1) {
+            return 0;
+        }
+
+        size_t bytes = tree_bytes() - offset(1) * sizeof(T);
+        huge_pages::region inner = huge_pages::map(bytes, options);
+        if (inner.addr == nullptr) {
+            return 0;
+        }
+
+        T* copy = static_cast<T*>(inner.addr);
+        std::memcpy(copy, _tree + offset(1), bytes);
+
+        huge_pages::unmap(_inner);
+        _inner = inner;
+        for (int h = 1; h < _num_layers; h++) {
+            _layers[h] = copy + (offset(h) - offset(1));
+        }
+        return _inner.page_bytes;
+    }
+
+    // The page size behind the internal layers' copy, or 0 if they are read in place.
+    size_t inner_page_bytes() const noexcept {
+        return _inner.page_bytes;
+    }
+
+    T lower_bound(T target) const noexcept {
+        return isa::dispatch([&](auto kernel) {
+            return dispatch_height(
+                [&]<int H>() { return _tree[leaf_position<H>(kernel, target)]; });
+        });
+    }
+
+    size_t lower_bound_rank(T target) const noexcept {
+        return isa::dispatch([&](auto kernel) {
+            return dispatch_height([&]<int H>() {
+                return std::min(leaf_position<H>(kernel, target), _n);
+            });
+        });
+    }
+
+    // The keys in [lo, hi), straight out of the leaf layer.
+    std::span<const T> range(T lo, T hi) const noexcept {
+        auto [first, last] = ranks(lo, hi);
+        return {_tree + first, last - first};
+    }
+
+    // The number of keys in [lo, hi). Only the two boundary leaves are read.
+    size_t count(T lo, T hi) const noexcept {
+        auto [first, last] = ranks(lo, hi);
+        return last - first;
+    }
+
+    template <size_t B>
+    void lower_bound_batch(const T* queries, T* results) const noexcept {
+        isa::dispatch([&](auto kernel) {
+            dispatch_height([&]<int H>() {
+                size_t positions[B];
+                descend_batch<B, H, false>(kernel, queries, positions);
+
+                for (size_t i = 0; i < B; i++) {
+                    T* leaf_block = _tree + positions[i] * block_len;
+                    results[i] = leaf_block[kernel.first_ge(queries[i], leaf_block)];
+                }
+            });
+        });
+    }
+
+    // Like lower_bound_batch(), but vertically: 16 queries share a vector and advance together, a
+    // layer at a time, with a branchless binary search of five gathers per node. B must be a
+    // multiple of 16. Needs AVX-512; elsewhere this is just lower_bound_batch().
+    template <size_t B>
+    void lower_bound_batch_vertical(const T* queries, T* results) const noexcept
+        requires(sizeof(T) == 4)
+    {
+        vertical_batch<B>(queries, results, 0);
+    }
+
+    // Vertical only while the layers fit in L2, where gathers are cheap, then one broadcast
+    // compare per query per node for the larger layers below, as lower_bound_batch() does.
+    template <size_t B>
+    void lower_bound_batch_hybrid(const T* queries, T* results) const noexcept
+        requires(sizeof(T) == 4)
+    {
+        int floor = _num_layers;
+        while (floor > 0 && (offset(floor) - offset(floor - 1)) * sizeof(T) <= vertical_bytes) {
+            floor--;
+        }
+
+        vertical_batch<B>(queries, results, floor);
+    }
+
+    // Builds a table over the top bits of the key range which, for each bucket, holds the deepest
+    // node that every target in the bucket descends through. lower_bound_radix() starts from that
+    // node, so it skips the layers above it with one table load. Where keys are spread evenly a
+    // bucket covers a few leaves and most layers are skipped; where they are bunched up buckets
+    // map to nodes near the root and skip little. There is no error to correct: the node is on the
+    // path the full descent would take. The table has up to 2^bits 4-byte entries, and isn't saved.
+    void build_radix_root(int bits = 16)
+        requires std::integral<T>
+    {
+        uint64_t lo = _n > 0 ? radix_key(_tree[0]) : 0;
+        uint64_t hi = _n > 0 ? radix_key(_tree[_n - 1]) : 0;
+
+        _radix_min = lo;
+        _radix_shift = 0;
+        while (((hi - lo) >> _radix_shift) >> bits != 0) {
+            _radix_shift++;
+        }
+
+        size_t buckets = ((hi - lo) >> _radix_shift) + 1;
+        _radix.resize(buckets);
+        for (size_t b = 0; b < buckets; b++) {
+            // The first and last buckets also take every target below and above the keys.
+            uint64_t first = b == 0 ? 0 : lo + (b << _radix_shift);
+            uint64_t last = b == buckets - 1 ? radix_key(std::numeric_limits<T>::max())
+                                             : lo + ((b + 1) << _radix_shift) - 1;
+            _radix[b] = common_node(from_radix_key(first), from_radix_key(last));
+        }
+    }
+
+    // lower_bound(), starting from the node build_radix_root() recorded for the target.
+    T lower_bound_radix(T target) const noexcept
+        requires std::integral<T>
+    {
+        if (_radix.empty()) {
+            return lower_bound(target);
+        }
+
+        return isa::dispatch([&](auto kernel) {
+            uint32_t start = _radix[radix_bucket(target)];
+            return dispatch_height((start & 15) + 1, [&]<int H>() {
+                return _tree[leaf_position_from<H>(kernel, target, (start >> 4) * block_len)];
+            });
+        });
+    }
+
+    // The rank is the index of the lower bound in the sorted input, or keys() if there is none.
+    // This is free: the leaf layer is the input itself, so it is just the leaf position.
+    template <size_t B>
+    void lower_bound_rank_batch(const T* queries, size_t* ranks) const noexcept {
+        isa::dispatch([&](auto kernel) {
+            dispatch_height([&]<int H>() {
+                size_t positions[B];
+                descend_batch<B, H, false>(kernel, queries, positions);
+
+                for (size_t i = 0; i < B; i++) {
+                    ranks[i] = leaf_rank(kernel, queries[i], positions[i]);
+                }
+            });
+        });
+    }
+
+    // The number of keys in [los[i], his[i]) for each of the B ranges. This is two batched
+    // descents, one per bound; the keys in between are never read.
+    template <size_t B>
+    void count_batch(const T* los, const T* his, size_t* counts) const noexcept {
+        size_t firsts[B];
+        lower_bound_rank_batch<B>(los, firsts);
+        lower_bound_rank_batch<B>(his, counts);
+
+        for (size_t i = 0; i < B; i++) {
+            counts[i] = std::max(counts[i], firsts[i]) - firsts[i];
+        }
+    }
+
+    // The keys in [los[i], his[i]) for each of the B ranges, as spans over the leaf layer.
+    template <size_t B>
+    void range_batch(const T* los, const T* his, std::span<const T>* ranges) const noexcept {
+        size_t firsts[B];
+        size_t lasts[B];
+        lower_bound_rank_batch<B>(los, firsts);
+        lower_bound_rank_batch<B>(his, lasts);
+
+        for (size_t i = 0; i < B; i++) {
+            ranges[i] = {_tree + firsts[i], std::max(lasts[i], firsts[i]) - firsts[i]};
+        }
+    }
+
+    // Writes the payload of the lower bound of each query, or V{} if there is none.
+    template <size_t B>
+    void lower_bound_value_batch(const T* queries, V* values) const noexcept
+        requires(!std::is_void_v<V>)
+    {
+        isa::dispatch([&](auto kernel) {
+            dispatch_height([&]<int H>() {
+                size_t positions[B];
+                descend_batch<B, H, true>(kernel, queries, positions);
+
+                for (size_t i = 0; i < B; i++) {
+                    values[i] = _values[leaf_rank(kernel, queries[i], positions[i])];
+                }
+            });
+        });
+    }
+
+    // Semi-join probes of a whole column against the keys. Bit i of bitmap, least significant bit
+    // first, is set exactly when column[i] is a key; bitmap needs (column.size() + 63) / 64 words,
+    // all of which are overwritten.
+    void probe_bitmap(std::span<const T> column, std::span<uint64_t> bitmap) const noexcept {
+        probe(column, [&](size_t first, uint64_t hits, const size_t*) {
+            bitmap[first / probe_batch] = hits;
+        });
+    }
+
+    // Appends the index in column of every value that is a key to rows, in column order, and if
+    // ranks is given, the rank of the matching key (its first copy, if repeated) alongside.
+    void probe_matches(std::span<const T> column, std::vector<size_t>& rows,
+                       std::vector<size_t>* ranks = nullptr) const {
+        probe(column, [&](size_t first, uint64_t hits, const size_t* hit_ranks) {
+            for (; hits != 0; hits &= hits - 1) {
+                int i = __builtin_ctzll(hits);
+                rows.push_back(first + i);
+                if (ranks != nullptr) {
+                    ranks->push_back(hit_ranks[i]);
+                }
+            }
+        });
+    }
+
+    // Looks up a stream of queries with up to W in flight, rather than in lockstep batches. Each
+    // in-flight query advances one layer per visit and prefetches its next block, so its miss is
+    // hidden behind the other W - 1. A query that reaches its leaf is reported straight away and
+    // its slot refilled from the input, so nothing waits for a batch to fill or drain.
+    //
+    // next(T& query) supplies the next query, returning false once the input is exhausted.
+    // emit(ticket, result) receives each lower bound, where ticket counts queries in input order
+    // from 0. Results arrive out of order.
+    template <size_t W, typename Next, typename Emit>
+        requires std::invocable<Next&, T&> && std::invocable<Emit&, size_t, T>
+    void lower_bound_stream(Next&& next, Emit&& emit) const {
+        isa::dispatch([&](auto kernel) {
+            dispatch_height([&]<int H>() { stream<W, H>(kernel, next, emit); });
+        });
+    }
+
+    // The lower bound of every query, in order, with W in flight.
+    template <size_t W>
+    void lower_bound_stream(std::span<const T> queries, std::span<T> results) const {
+        size_t i = 0;
+        lower_bound_stream<W>(
+            [&](T& query) {
+                if (i == queries.size()) {
+                    return false;
+                }
+                query = queries[i++];
+                return true;
+            },
+            [&](size_t ticket, T result) { results[ticket] = result; });
+    }
+
+    // The lower bound of every query, in order, for batches large enough that many queries share
+    // upper nodes or repeat. Unless they already are, the queries are radix sorted along with their
+    // positions. Walking them in sorted order, a query only searches the nodes below the deepest
+    // one on the previous query's path that it still falls under, so each internal node is
+    // searched about once per run of queries beneath it. Unsorted inputs of more than 2^32 queries
+    // are sorted and walked 2^32 at a time.
+    void lower_bound_bulk(std::span<const T> queries, std::span<T> results) const
+        requires std::integral<T>
+    {
+        if (std::is_sorted(queries.begin(), queries.end())) {
+            walk_sorted(
+                queries.size(), [&](size_t i) { return queries[i]; },
+                [&](size_t i, T result) { results[i] = result; });
+            return;
+        }
+
+        for (size_t first = 0; first < queries.size(); first += max_sorted_queries) {
+            size_t count = std::min(queries.size() - first, max_sorted_queries);
+            std::vector<ranked_query> sorted = sort_queries(queries.subspan(first, count));
+            T* chunk_results = results.data() + first;
+            walk_sorted(
+                sorted.size(), [&](size_t i) { return sorted[i].query; },
+                [&](size_t i, T result) { chunk_results[sorted[i].position] = result; });
+        }
+    }
+
+    // The tree and its payload, padding included.
+    size_t bytes() const noexcept {
+        return tree_bytes() + payload_bytes();
+    }
+
+    size_t keys() const noexcept {
+        return _n;
+    }
+
+    // The leaf layer, which is the sorted input itself.
+    std::span<const T> leaves() const noexcept {
+        return {_tree, _n};
+    }
+
+    int height() const noexcept {
+        return _num_layers;
+    }
+
+private:
+    // The header takes a whole page so the tree stays page (and so block) aligned in the mapping.
+    static constexpr size_t file_header_bytes = 4096;
+    static constexpr uint32_t file_version = 1;
+    static constexpr char file_magic[8] = {'b', 'p', 'l', 'u', 's', 0, 0, 0};
+
+    struct file_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t key_bytes;
+        uint32_t key_kind;
+        uint32_t value_bytes;  // 0 if the tree has no payload
+        uint64_t n;
+        uint64_t num_layers;
+        uint64_t offsets[max_layers + 1];
+    };
+    static_assert(sizeof(file_header) <= file_header_bytes);
+
+    // The largest layer lower_bound_batch_hybrid() searches vertically: about an L2.
+    static constexpr size_t vertical_bytes = 1 << 20;
+
+    // Large enough that handing a chunk to a thread is cheap next to filling it.
+    static constexpr size_t parallel_chunk_keys = 1 << 16;
+    static constexpr size_t stream_chunk_keys = 1 << 16;
+
+    // One bitmap word of column values per batched descent.
+    static constexpr size_t probe_batch = 64;
+
+    T* _tree;
+    V* _values = nullptr;
+    size_t _n;
+    int _num_layers;
+    size_t _offsets[max_layers + 1];
+    const T* _layers[max_layers];  // the first key of each layer
+
+    // The copy of the internal layers made by cache_inner_layers(), if any.
+    huge_pages::region _inner;
+
+    // The radix table, if built: bucket (key - _radix_min) >> _radix_shift holds a node as its
+    // block index on its layer, shifted up past the layer in the low 4 bits.
+    std::vector<uint32_t> _radix;
+    uint64_t _radix_min = 0;
+    int _radix_shift = 0;
+
+    // Set if the tree was opened from a file rather than built.
+    void* _mapping = nullptr;
+    size_t _mapped_bytes = 0;
+
+    // Set if _tree belongs to a tree_arena rather than to this tree.
+    bool _pooled = false;
+
+    runtime_bplus(const char* path, open_options options) {
+        struct descriptor {
+            int fd;
+            ~descriptor() {
+                if (fd != -1) {
+                    ::close(fd);
+                }
+            }
+        } file{::open(path, O_RDONLY)};
+
+        if (file.fd == -1) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        struct stat st = {};
+        file_header header = {};
+        if (fstat(file.fd, &st) != 0 ||
+            pread(file.fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+            throw std::runtime_error(std::string("runtime_bplus: failed to read ") + path);
+        }
+
+        // Nothing in the header is used to size anything until it is known to describe a tree of
+        // this type whose keys fit in the file.
+        size_t file_bytes = st.st_size;
+        auto incompatible = [&] {
+            return std::runtime_error(std::string("runtime_bplus: not a compatible tree: ") + path);
+        };
+        if (!compatible(header) || file_bytes < file_header_bytes ||
+            header.n > (file_bytes - file_header_bytes) / sizeof(T)) {
+            throw incompatible();
+        }
+
+        _n = header.n;
+        layout();
+
+        size_t body_bytes = file_bytes - file_header_bytes;
+        if (!same_layout(header) || body_bytes < tree_bytes() ||
+            (body_bytes - tree_bytes()) / (_n + 1) < header.value_bytes) {
+            throw incompatible();
+        }
+
+        int flags = MAP_SHARED | (options.populate ? MAP_POPULATE : 0);
+        void* mapping = mmap(nullptr, file_bytes, PROT_READ, flags, file.fd, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        if (options.huge_pages) {
+            madvise(mapping, file_bytes, MADV_HUGEPAGE);
+        }
+
+        _mapping = mapping;
+        _mapped_bytes = file_bytes;
+
+        // The mapping is read only, and nothing writes to a built tree.
+        _tree = reinterpret_cast<T*>(static_cast<char*>(mapping) + file_header_bytes);
+        point_layers();
+        if constexpr (!std::is_void_v<V>) {
+            _values = reinterpret_cast<V*>(reinterpret_cast<char*>(_tree) + tree_bytes());
+        }
+    }
+
+    static constexpr uint32_t key_kind() {
+        return std::is_floating_point_v<T> ? 2 : std::is_signed_v<T> ? 1 : 0;
+    }
+
+    static constexpr size_t value_bytes() {
+        if constexpr (std::is_void_v<V>) {
+            return 0;
+        } else {
+            return sizeof(V);
+        }
+    }
+
+    size_t tree_bytes() const noexcept {
+        return size() * sizeof(T);  // a multiple of the 64 byte block size
+    }
+
+    size_t payload_bytes() const noexcept {
+        return _values != nullptr ? (_n + 1) * value_bytes() : 0;
+    }
+
+    file_header make_header() const noexcept {
+        file_header header = {};
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = file_version;
+        header.key_bytes = sizeof(T);
+        header.key_kind = key_kind();
+        header.value_bytes = _values != nullptr ? value_bytes() : 0;
+        header.n = _n;
+        header.num_layers = _num_layers;
+        std::copy_n(_offsets, max_layers + 1, header.offsets);
+        return header;
+    }
+
+    // Whether header is that of a saved tree with these key and value types.
+    static bool compatible(const file_header& header) noexcept {
+        return std::memcmp(header.magic, file_magic, sizeof(file_magic)) == 0 &&
+               header.version == file_version && header.key_bytes == sizeof(T) &&
+               header.key_kind == key_kind() &&
+               (std::is_void_v<V> || header.value_bytes == value_bytes());
+    }
+
+    // Whether a file written with this header has the layout layout() just computed.
+    bool same_layout(const file_header& header) const noexcept {
+        return header.num_layers == static_cast<uint64_t>(_num_layers) &&
+               std::equal(_offsets, _offsets + _num_layers + 1, header.offsets);
+    }
+
+    // Computes the height and layer offsets for _n keys.
+    void layout() {
+        _num_layers = 1;
+        size_t num_keys = std::max<size_t>(_n, 1);
+        while (num_keys > block_len) {
+            num_keys = parent_layer_keys(num_keys);
+            _num_layers++;
+        }
+
+        if (_num_layers > max_layers) {
+            throw std::length_error("runtime_bplus: too many keys");
+        }
+
+        // An empty input still gets a single leaf block of padding so lookups stay branchless.
+        _offsets[0] = 0;
+        num_keys = std::max<size_t>(_n, 1);
+        for (int h = 0; h < _num_layers; h++) {
+            _offsets[h + 1] = _offsets[h] + block_count(num_keys) * block_len;
+            num_keys = parent_layer_keys(num_keys);
+        }
+    }
+
+    void allocate(size_t payload_bytes, numa::placement where = {}) {
+        layout();
+
+        size_t bytes = tree_bytes() + payload_bytes;
+        size_t padded_bytes =
+            (bytes + constants::page_size - 1) / constants::page_size * constants::page_size;
+
+        _tree = static_cast<T*>(std::aligned_alloc(constants::page_size, padded_bytes));
+        madvise(_tree, padded_bytes, MADV_HUGEPAGE);
+        numa::place(_tree, padded_bytes, where);
+        point_layers();
+
+        if (payload_bytes > 0) {
+            _values = reinterpret_cast<V*>(reinterpret_cast<char*>(_tree) + tree_bytes());
+        }
+    }
+
+    void allocate(size_t payload_bytes, tree_arena& arena) {
+        layout();
+
+        _tree = static_cast<T*>(arena.allocate(tree_bytes() + payload_bytes));
+        _pooled = true;
+        point_layers();
+
+        if (payload_bytes > 0) {
+            _values = reinterpret_cast<V*>(reinterpret_cast<char*>(_tree) + tree_bytes());
+        }
+    }
+
+    void point_layers() noexcept {
+        for (int h = 0; h < _num_layers; h++) {
+            _layers[h] = _tree + offset(h);
+        }
+    }
+
+    // Both descents are issued from the same function so that their cache misses overlap.
+    std::pair<size_t, size_t> ranks(T lo, T hi) const noexcept {
+        return isa::dispatch([&](auto kernel) {
+            return dispatch_height([&]<int H>() {
+                size_t first = std::min(leaf_position<H>(kernel, lo), _n);
+                size_t last = std::min(leaf_position<H>(kernel, hi), _n);
+                return std::pair{first, std::max(first, last)};
+            });
+        });
+    }
+
+    template <typename F>
+    auto dispatch_height(F&& f) const noexcept {
+        return dispatch_height(_num_layers, f);
+    }
+
+    // Calls f<layers>(), for a tree of that height or for the part of one below a node.
+    template <typename F>
+    static auto dispatch_height(int layers, F&& f) noexcept {
+        switch (layers) {
+        case 1:
+            return f.template operator()<1>();
+        case 2:
+            return f.template operator()<2>();
+        case 3:
+            return f.template operator()<3>();
+        case 4:
+            return f.template operator()<4>();
+        case 5:
+            return f.template operator()<5>();
+        case 6:
+            return f.template operator()<6>();
+        case 7:
+            return f.template operator()<7>();
+        case 8:
+            return f.template operator()<8>();
+        case 9:
+            return f.template operator()<9>();
+        case 10:
+            return f.template operator()<10>();
+        case 11:
+            return f.template operator()<11>();
+        default:
+            return f.template operator()<12>();
+        }
+    }
+
+    size_t offset(int layer) const noexcept {
+        return _offsets[layer];
+    }
+
+    size_t size() const noexcept {
+        return _offsets[_num_layers];  // offset of non-existent last layer
+    }
+
+    // Orders integer keys as unsigned integers, so the table can be indexed by their difference.
+    static uint64_t radix_key(T key) noexcept {
+        using U = std::make_unsigned_t<T>;
+        U bits = static_cast<U>(key);
+        if constexpr (std::is_signed_v<T>) {
+            bits ^= U{1} << (sizeof(T) * CHAR_BIT - 1);
+        }
+        return bits;
+    }
+
+    static T from_radix_key(uint64_t key) noexcept {
+        using U = std::make_unsigned_t<T>;
+        U bits = static_cast<U>(key);
+        if constexpr (std::is_signed_v<T>) {
+            bits ^= U{1} << (sizeof(T) * CHAR_BIT - 1);
+        }
+        return static_cast<T>(bits);
+    }
+
+    size_t radix_bucket(T target) const noexcept {
+        uint64_t key = radix_key(target);
+        uint64_t above = key > _radix_min ? key - _radix_min : 0;
+        return std::min<uint64_t>(above >> _radix_shift, _radix.size() - 1);
+    }
+
+    // The deepest node on the paths of both lo and hi, and so of every target in between, as a
+    // radix table entry. The root if its block index doesn't fit.
+    uint32_t common_node(T lo, T hi) const noexcept {
+        size_t block = 0;
+        int h = _num_layers - 1;
+        for (; h > 0; h--) {
+            const T* node_keys = _layers[h] + block * block_len;
+            int i = isa::scalar::first_ge(lo, node_keys);
+            if (i != isa::scalar::first_ge(hi, node_keys)) {
+                break;
+            }
+            block = block * (block_len + 1) + i;
+        }
+
+        if (block >= (size_t{1} << 28)) {
+            return static_cast<uint32_t>(_num_layers - 1);
+        }
+        return static_cast<uint32_t>(block << 4 | static_cast<size_t>(h));
+    }
+
+    // The index into the leaf layer of the lower bound of target.
+    template <int H, typename Isa>
+    size_t leaf_position(Isa kernel, T target) const noexcept {
+        return leaf_position_from<H>(kernel, target, 0);
+    }
+
+    // leaf_position() from the block at k (in keys) on layer H - 1, rather than the root.
+    template <int H, typename Isa>
+    size_t leaf_position_from(Isa, T target, size_t k) const noexcept {
+        for (int h = H - 1; h > 0; h--) {
+            int i = Isa::first_ge(target, _layers[h] + k);
+
+            k = k * (block_len + 1) + i * block_len;
+        }
+
+        return k + Isa::first_ge(target, _tree + k);
+    }
+
+    // Walks B queries down to the leaf layer in lockstep, prefetching the next block of each
+    // query while the others are searched. Leaves the leaf block index of each query in
+    // positions. With Payload set, the payload lines of the leaf block are prefetched as well.
+    template <size_t B, int H, bool Payload, typename Isa>
+    void descend_batch(Isa, const T* queries, size_t* positions) const noexcept {
+        for (size_t i = 0; i < B; i++) {
+            positions[i] = 0;
+        }
+
+        for (int h = H - 1; h > 0; h--) {
+            for (size_t i = 0; i < B; i++) {
+                size_t k = positions[i];
+
+                int key_i = Isa::first_ge(queries[i], _layers[h] + k * block_len);
+                positions[i] = k * (block_len + 1) + key_i;
+
+                const T* next_block = _layers[h - 1] + positions[i] * block_len;
+                _mm_prefetch(reinterpret_cast<const char*>(next_block), _MM_HINT_T0);
+
+                if constexpr (Payload) {
+                    if (h == 1) {
+                        prefetch_payload(positions[i]);
+                    }
+                }
+            }
+        }
+    }
+
+    // The AMAC loop behind lower_bound_stream(): a ring of W query state machines, each a
+    // (layer, block) position, visited round robin.
+    template <size_t W, int H, typename Isa, typename Next, typename Emit>
+    void stream(Isa, Next& next, Emit& emit) const {
+        struct slot {
+            T query;
+            size_t ticket;
+            size_t block;
+            int layer;  // -1 once the input has run out
+        };
+
+        slot slots[W];
+        size_t tickets = 0;
+        size_t in_flight = 0;
+
+        auto refill = [&](slot& s) {
+            if (next(s.query)) {
+                s.ticket = tickets++;
+                s.block = 0;
+                s.layer = H - 1;
+                in_flight++;
+            } else {
+                s.layer = -1;
+            }
+        };
+
+        for (slot& s : slots) {
+            refill(s);
+        }
+
+        while (in_flight > 0) {
+            for (slot& s : slots) {
+                if (s.layer > 0) {
+                    int i = Isa::first_ge(s.query, _layers[s.layer] + s.block * block_len);
+                    s.block = s.block * (block_len + 1) + i;
+                    s.layer--;
+
+                    const T* next_block = _layers[s.layer] + s.block * block_len;
+                    _mm_prefetch(reinterpret_cast<const char*>(next_block), _MM_HINT_T0);
+                } else if (s.layer == 0) {
+                    T* leaf_block = _tree + s.block * block_len;
+                    emit(s.ticket, leaf_block[Isa::first_ge(s.query, leaf_block)]);
+
+                    in_flight--;
+                    refill(s);
+                }
+            }
+        }
+    }
+
+    // A query and its position in the caller's batch, or in the piece of it being sorted.
+    struct ranked_query {
+        T query;
+        uint32_t position;
+    };
+
+    // As many queries as a 32-bit ranked_query::position can tell apart.
+    static constexpr size_t max_sorted_queries = size_t{1} << 32;
+
+    static constexpr int radix_bits = 11;
+    static constexpr size_t walk_distance = 16;
+    static constexpr int radix_passes = (sizeof(T) * CHAR_BIT + radix_bits - 1) / radix_bits;
+
+    // LSD radix sort of queries by radix_key(), radix_bits per pass, with each query's position
+    // carried along. The counts for every pass are taken in one read, and passes where every
+    // query has the same digit are skipped. At most max_sorted_queries queries.
+    static std::vector<ranked_query> sort_queries(std::span<const T> queries) {
+        constexpr size_t buckets = size_t{1} << radix_bits;
+        size_t n = queries.size();
+
+        std::vector<size_t> counts(radix_passes * buckets);
+        for (T query : queries) {
+            uint64_t key = radix_key(query);
+            for (int pass = 0; pass < radix_passes; pass++) {
+                counts[pass * buckets + ((key >> (pass * radix_bits)) & (buckets - 1))]++;
+            }
+        }
+
+        std::vector<ranked_query> sorted(n);
+        std::vector<ranked_query> scratch(n);
+        for (size_t i = 0; i < n; i++) {
+            sorted[i] = {queries[i], static_cast<uint32_t>(i)};
+        }
+
+        for (int pass = 0; pass < radix_passes; pass++) {
+            size_t* starts = counts.data() + pass * buckets;
+            if (std::find(starts, starts + buckets, n) != starts + buckets) {
+                continue;
+            }
+
+            size_t start = 0;
+            for (size_t b = 0; b < buckets; b++) {
+                start += std::exchange(starts[b], start);
+            }
+
+            for (const ranked_query& q : sorted) {
+                uint64_t digit = (radix_key(q.query) >> (pass * radix_bits)) & (buckets - 1);
+                scratch[starts[digit]++] = q;
+            }
+            sorted.swap(scratch);
+        }
+        return sorted;
+    }
+
+    template <typename Get, typename Emit>
+    void walk_sorted(size_t count, Get&& get, Emit&& emit) const {
+        isa::dispatch([&](auto kernel) {
+            dispatch_height([&]<int H>() { walk<H>(kernel, count, get, emit); });
+        });
+    }
+
+    // The walk behind lower_bound_bulk(), over get(0) <= get(1) <= ... <= get(count - 1). The
+    // current path is kept as the block searched on each layer and the largest query for which the
+    // child chosen there stays the same, so the next query, being no smaller, resumes from the
+    // lowest layer whose choice it still shares. A duplicate shares every choice and goes straight
+    // to its leaf. Leaf blocks are prefetched and searched walk_distance queries later, so their
+    // misses overlap. emit(i, result) receives the lower bound of get(i).
+    template <int H, typename Isa, typename Get, typename Emit>
+    void walk(Isa, size_t count, Get& get, Emit& emit) const {
+        struct pending {
+            T query;
+            const T* leaf;
+        };
+
+        size_t blocks[H] = {};
+        T bounds[H] = {};
+        pending ring[walk_distance];
+
+        auto finish = [&](size_t i) {
+            const pending& p = ring[i % walk_distance];
+            emit(i, p.leaf[Isa::first_ge(p.query, p.leaf)]);
+        };
+
+        for (size_t i = 0; i < count; i++) {
+            T query = get(i);
+
+            // The layer whose node has to be searched again: below the lowest still shared choice.
+            int from = H - 1;
+            if (i > 0) {
+                int h = 1;
+                while (h < H && query > bounds[h]) {
+                    h++;
+                }
+                from = h - 1;
+            }
+
+            for (int h = from; h > 0; h--) {
+                const T* node_keys = _layers[h] + blocks[h] * block_len;
+                int key_i = Isa::first_ge(query, node_keys);
+
+                // Child key_i holds the targets up to node_keys[key_i], or up to its parent's bound.
+                bounds[h] = key_i < block_len ? node_keys[key_i]
+                            : h == H - 1  ? node<T>::max_key
+                                          : bounds[h + 1];
+                blocks[h - 1] = blocks[h] * (block_len + 1) + key_i;
+            }
+
+            if (i >= walk_distance) {
+                finish(i - walk_distance);
+            }
+
+            const T* leaf = _tree + blocks[0] * block_len;
+            _mm_prefetch(reinterpret_cast<const char*>(leaf), _MM_HINT_T0);
+            ring[i % walk_distance] = {query, leaf};
+        }
+
+        for (size_t i = count > walk_distance ? count - walk_distance : 0; i < count; i++) {
+            finish(i);
+        }
+    }
+
+    // The loop behind the probes: descend_batch() over each probe_batch values of the column in
+    // place, then an exact compare against the lower bound in the leaf. Only a short last batch is
+    // copied, padded with its last value. emit(first, hits, ranks) receives each batch's bitmask
+    // of matches, starting at column[first], and the lower bound rank of every value in it.
+    template <typename Emit>
+    void probe(std::span<const T> column, Emit&& emit) const {
+        isa::dispatch([&](auto kernel) {
+            dispatch_height([&]<int H>() {
+                for (size_t first = 0; first < column.size(); first += probe_batch) {
+                    size_t count = std::min(probe_batch, column.size() - first);
+
+                    T padded[probe_batch];
+                    const T* values = column.data() + first;
+                    if (count < probe_batch) {
+                        std::copy_n(values, count, padded);
+                        std::fill(padded + count, padded + probe_batch, values[count - 1]);
+                        values = padded;
+                    }
+
+                    size_t positions[probe_batch];
+                    descend_batch<probe_batch, H, false>(kernel, values, positions);
+
+                    uint64_t hits = 0;
+                    for (size_t i = 0; i < probe_batch; i++) {
+                        positions[i] = leaf_rank(kernel, values[i], positions[i]);
+                        bool hit = positions[i] < _n && _tree[positions[i]] == values[i];
+                        hits |= static_cast<uint64_t>(hit) << i;
+                    }
+                    if (count < probe_batch) {
+                        hits &= (uint64_t{1} << count) - 1;
+                    }
+
+                    emit(first, hits, positions);
+                }
+            });
+        });
+    }
+
+    // Searches layers down to floor vertically, and any below that per query. Gather indices are
+    // 32-bit, so trees too large for them (and hosts without AVX-512) take the per query path.
+    template <size_t B>
+    void vertical_batch(const T* queries, T* results, int floor) const noexcept {
+        static_assert(B % 16 == 0);
+
+        if (isa::active() != isa::level::avx512 || size() > INT32_MAX) {
+            lower_bound_batch<B>(queries, results);
+            return;
+        }
+
+        dispatch_height([&]<int H>() { vertical_avx512<B, H>(queries, results, floor); });
+    }
+
+    template <size_t B, int H>
+    [[gnu::target("avx512f,bmi")]]
+    void vertical_avx512(const T* queries, T* results, int floor) const noexcept {
+        constexpr size_t groups = B / 16;
+
+        __m512i targets[groups];
+        __m512i blocks[groups];
+        for (size_t g = 0; g < groups; g++) {
+            targets[g] = _mm512_loadu_si512(queries + g * 16);
+            blocks[g] = _mm512_setzero_si512();
+        }
+
+        // Groups are the inner loop, so the gathers of one overlap the misses of the others.
+        for (int h = H - 1; h >= std::max(floor, 1); h--) {
+            const T* layer = _layers[h];
+            for (size_t g = 0; g < groups; g++) {
+                __m512i i = vertical_first_ge(layer, blocks[g], targets[g]);
+                __m512i times_17 = _mm512_add_epi32(times_16(blocks[g]), blocks[g]);
+                blocks[g] = _mm512_add_epi32(times_17, i);
+            }
+        }
+
+        if (floor == 0) {
+            for (size_t g = 0; g < groups; g++) {
+                __m512i i = vertical_first_ge(_tree, blocks[g], targets[g]);
+                __m512i leaf = _mm512_add_epi32(times_16(blocks[g]), i);
+                _mm512_storeu_si512(results + g * 16, gather(_tree, leaf));
+            }
+            return;
+        }
+
+        size_t positions[B];
+        for (size_t g = 0; g < groups; g++) {
+            alignas(64) int32_t lanes[16];
+            _mm512_store_si512(lanes, blocks[g]);
+            std::copy_n(lanes, 16, positions + g * 16);
+        }
+
+        for (int h = floor - 1; h > 0; h--) {
+            for (size_t i = 0; i < B; i++) {
+                size_t k = positions[i];
+
+                int key_i = isa::avx512::first_ge(queries[i], _layers[h] + k * block_len);
+                positions[i] = k * (block_len + 1) + key_i;
+
+                const T* next_block = _layers[h - 1] + positions[i] * block_len;
+                _mm_prefetch(reinterpret_cast<const char*>(next_block), _MM_HINT_T0);
+            }
+        }
+
+        for (size_t i = 0; i < B; i++) {
+            T* leaf_block = _tree + positions[i] * block_len;
+            results[i] = leaf_block[isa::avx512::first_ge(queries[i], leaf_block)];
+        }
+    }
+
+    // first_ge() for 16 queries at once, each in its own block of layer. Counting the keys below
+    // the target by binary search: four halving steps find min(count, 15), and a fifth tells 15
+    // from 16.
+    [[gnu::target("avx512f,bmi")]]
+    static __m512i vertical_first_ge(const T* layer, __m512i blocks, __m512i targets) noexcept {
+        __m512i base = times_16(blocks);
+        __m512i i = _mm512_setzero_si512();
+
+        for (int step = 8; step >= 1; step /= 2) {
+            __m512i last = _mm512_add_epi32(base, i);
+            __m512i probe = _mm512_add_epi32(last, _mm512_set1_epi32(step - 1));
+            __m512i keys = gather(layer, probe);
+            i = _mm512_mask_add_epi32(i, less_than(keys, targets), i, _mm512_set1_epi32(step));
+        }
+
+        __m512i keys = gather(layer, _mm512_add_epi32(base, i));
+        return _mm512_mask_add_epi32(i, less_than(keys, targets), i, _mm512_set1_epi32(1));
+    }
+
+    // gather() and times_16() use the masked intrinsics, as GCC 12 warns that the plain ones'
+    // undefined sources may be used uninitialized.
+    [[gnu::target("avx512f,bmi")]]
+    static __m512i gather(const T* layer, __m512i indices) noexcept {
+        return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xffff, indices, layer, 4);
+    }
+
+    [[gnu::target("avx512f,bmi")]]
+    static __m512i times_16(__m512i blocks) noexcept {
+        return _mm512_maskz_slli_epi32(0xffff, blocks, 4);
+    }
+
+    // key < target per lane, ordering as the node search kernels do.
+    [[gnu::target("avx512f,bmi")]]
+    static __mmask16 less_than(__m512i keys, __m512i targets) noexcept {
+        if constexpr (std::is_floating_point_v<T>) {
+            return _mm512_cmp_ps_mask(_mm512_castsi512_ps(keys), _mm512_castsi512_ps(targets),
+                                      _CMP_LT_OQ);
+        } else if constexpr (std::is_signed_v<T>) {
+            return _mm512_cmplt_epi32_mask(keys, targets);
+        } else {
+            return _mm512_cmplt_epu32_mask(keys, targets);
+        }
+    }
+
+    void prefetch_payload(size_t leaf_block) const noexcept
+        requires(!std::is_void_v<V>)
+    {
+        const V* payload = _values + leaf_block * block_len;
+        const char* first = reinterpret_cast<const char*>(payload);
+        for (size_t line = 0; line < block_len * sizeof(V); line += 64) {
+            _mm_prefetch(first + line, _MM_HINT_T0);
+        }
+    }
+
+    template <typename Isa>
+    size_t leaf_rank(Isa, T query, size_t leaf_block) const noexcept {
+        T* leaf = _tree + leaf_block * block_len;
+        size_t rank = leaf_block * block_len + Isa::first_ge(query, leaf);
+        return std::min(rank, _n);
+    }
+
+    void build(std::span<const T> data, thread_pool* pool = nullptr) {
+        for_chunks(pool, _n, [&](size_t begin, size_t end) {
+            memcpy(_tree + begin, data.data() + begin, (end - begin) * sizeof(T));
+        });
+        build_internal(pool);
+    }
+
+    // Streams the leaf layer in from read(), which fills each chunk with the next sorted keys.
+    template <typename Read>
+    void build_streaming(Read& read) {
+        for (size_t begin = 0; begin < _n; begin += stream_chunk_keys) {
+            size_t end = std::min(begin + stream_chunk_keys, _n);
+            read(std::span<T>(_tree + begin, end - begin));
+        }
+        build_internal(nullptr);
+    }
+
+    // Pads the leaf layer and fills the internal layers from it. Each internal key only reads
+    // the leaf layer, so every layer (and every part of one) can be filled independently.
+    void build_internal(thread_pool* pool) {
+        std::fill(_tree + _n, _tree + offset(1), node<T>::max_key);
+
+        for (int h = 1; h < _num_layers; h++) {
+            size_t layer_start = offset(h);
+            size_t layer_end = offset(h + 1);
+
+            // The leftmost leaf index under the subtree of child c of this layer is c * stride.
+            size_t stride = block_len;
+            for (int l = 0; l < h - 1; l++) {
+                stride *= (block_len + 1);
+            }
+
+            for_chunks(pool, layer_end - layer_start, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    size_t block = i / block_len;
+                    size_t block_key_offset = i - block * block_len;
+
+                    size_t block_offset_on_new_layer = block * (block_len + 1);
+                    size_t right_key_offset = (block_offset_on_new_layer + block_key_offset) + 1;
+
+                    size_t leftmost_index = right_key_offset * stride;
+                    _tree[layer_start + i] =
+                        (leftmost_index < _n ? _tree[leftmost_index] : node<T>::max_key);
+                }
+            });
+        }
+    }
+
+    // Calls f(begin, end) over [0, count) in parallel_chunk_keys pieces across the pool, or once
+    // inline without one.
+    template <typename F>
+    static void for_chunks(thread_pool* pool, size_t count, F&& f) {
+        if (pool == nullptr || pool->size() == 1 || count <= parallel_chunk_keys) {
+            f(0, count);
+            return;
+        }
+
+        size_t chunks = (count + parallel_chunk_keys - 1) / parallel_chunk_keys;
+        pool->parallel_for(chunks, [&](size_t chunk) {
+            size_t begin = chunk * parallel_chunk_keys;
+            f(begin, std::min(begin + parallel_chunk_keys, count));
+        });
+    }
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+// Query streams with the access patterns we actually see, rather than only uniform random keys,
+// which never reuse a cache line below the top layers.
+enum class workload {
+    uniform,  // uniform over [min key, max key]
+    zipf,     // existing keys, with Zipfian popularity scattered over the key space
+    sorted,   // uniform keys in increasing order, as from a merge join or an ordered scan
+    hot_set,  // uniform over a small fixed set of existing keys
+    replay,   // read from a file of recorded queries
+};
+
+inline constexpr workload all_workloads[] = {
+    workload::uniform, workload::zipf, workload::sorted, workload::hot_set, workload::replay,
+};
+
+inline const char* name(workload w) noexcept {
+    switch (w) {
+    case workload::uniform:
+        return "uniform";
+    case workload::zipf:
+        return "zipf";
+    case workload::sorted:
+        return "sorted";
+    case workload::hot_set:
+        return "hot_set";
+    default:
+        return "replay";
+    }
+}
+
+struct workload_options {
+    double zipf_skew = 0.99;    // YCSB's default
+    size_t hot_keys = 1 << 12;  // at most this many leaf lines, which fit in L2
+    std::string replay_path;    // raw queries of the key type, in native byte order
+    uint64_t seed = 12345;
+};
+
+// Samples k in [1, n] with probability proportional to 1 / k^s, in constant time and space using
+// rejection-inversion (Hörmann and Derflinger, 1996), so n can be as large as the key count.
+class zipf_distribution {
+public:
+    zipf_distribution(uint64_t n, double s)
+        : _n(n),
+          _s(s),
+          _h_integral_x1(h_integral(1.5) - 1),
+          _h_integral_n(h_integral(n + 0.5)),
+          _threshold(2 - h_integral_inverse(h_integral(2.5) - h(2))) {}
+
+    template <typename Rng>
+    uint64_t operator()(Rng& rng) {
+        std::uniform_real_distribution<double> unit;
+        while (true) {
+            double u = _h_integral_n + unit(rng) * (_h_integral_x1 - _h_integral_n);
+            double x = h_integral_inverse(u);
+            double k = std::clamp(std::floor(x + 0.5), 1.0, static_cast<double>(_n));
+
+            if (k - x <= _threshold || u >= h_integral(k + 0.5) - h(k)) {
+                return static_cast<uint64_t>(k);
+            }
+        }
+    }
+
+private:
+    uint64_t _n;
+    double _s;
+    double _h_integral_x1;
+    double _h_integral_n;
+    double _threshold;
+
+    double h(double x) const noexcept {
+        return std::exp(-_s * std::log(x));
+    }
+
+    double h_integral(double x) const noexcept {
+        double log_x = std::log(x);
+        return helper2((1 - _s) * log_x) * log_x;
+    }
+
+    double h_integral_inverse(double x) const noexcept {
+        double t = std::max(x * (1 - _s), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+
+    // log(1 + x) / x and (exp(x) - 1) / x, accurate as x approaches 0 (where s approaches 1).
+    static double helper1(double x) noexcept {
+        if (std::abs(x) > 1e-8) {
+            return std::log1p(x) / x;
+        }
+        return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+
+    static double helper2(double x) noexcept {
+        if (std::abs(x) > 1e-8) {
+            return std::expm1(x) / x;
+        }
+        return 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+    }
+};
+
+// Generates count queries of the given workload against the sorted keys. Streams are precomputed
+// so that generating them stays out of the measured loop. Every workload but replay draws from the
+// keys, and throws std::invalid_argument if there are none.
+template <typename T = int>
+std::vector<T> generate_queries(workload w, std::span<const T> keys, size_t count,
+                                const workload_options& options = {}) {
+    if (keys.empty() && w != workload::replay) {
+        throw std::invalid_argument(std::string("no keys to draw ") + name(w) + " queries from");
+    }
+
+    std::mt19937_64 rng(options.seed);
+    std::vector<T> queries(count);
+
+    switch (w) {
+    case workload::uniform:
+    case workload::sorted: {
+        uniform_distribution<T> dist(keys.front(), keys.back());
+        for (T& query : queries) {
+            query = dist(rng);
+        }
+        if (w == workload::sorted) {
+            std::sort(queries.begin(), queries.end());
+        }
+        break;
+    }
+    case workload::zipf: {
+        // Popularity follows rank, but neighbouring ranks shouldn't be neighbouring keys, or the
+        // hot keys would all share a handful of leaves. A multiplicative hash scatters them.
+        zipf_distribution dist(keys.size(), options.zipf_skew);
+        for (T& query : queries) {
+            uint64_t rank = dist(rng) - 1;
+            query = keys[rank * 0x9e3779b97f4a7c15ULL % keys.size()];
+        }
+        break;
+    }
+    case workload::hot_set: {
+        std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+        std::vector<T> hot(std::min(options.hot_keys, keys.size()));
+        for (T& key : hot) {
+            key = keys[pick(rng)];
+        }
+
+        std::uniform_int_distribution<size_t> hot_pick(0, hot.size() - 1);
+        for (T& query : queries) {
+            query = hot[hot_pick(rng)];
+        }
+        break;
+    }
+    case workload::replay: {
+        std::ifstream file(options.replay_path, std::ios::binary | std::ios::ate);
+        size_t recorded = file ? static_cast<size_t>(file.tellg()) / sizeof(T) : 0;
+        if (recorded == 0) {
+            throw std::runtime_error("no recorded queries in '" + options.replay_path + "'");
+        }
+
+        // Shorter recordings are played on a loop.
+        file.seekg(0);
+        size_t read = std::min(recorded, count);
+        file.read(reinterpret_cast<char*>(queries.data()), read * sizeof(T));
+        for (size_t i = read; i < count; i++) {
+            queries[i] = queries[i - read];
+        }
+        break;
+    }
+    }
+
+    return queries;
+}